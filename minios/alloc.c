@@ -39,9 +39,35 @@
 #define MAP_ANONYMOUS MAP_ANON
 //#endif
 
-// The memory allocated here is not on the GC heap (and it may contain pointers
-// that need to be GC'd) so we must somehow trace this memory.  We do it by
-// keeping a linked list of all mmap'd regions, and tracing them explicitly.
+// Native code is allocated from an executable arena that is mapped once
+// (on first use) and carved into slabs of EXEC_SLAB_SIZE bytes. Each
+// slab serves one size class (powers of two from 64 bytes up to
+// EXEC_MAX_BLOCK), so the many small functions of a module share pages
+// instead of getting a page-rounded mapping each. A slab index is
+// derived from the address and the size class from the size, which
+// makes freeing O(1).
+//
+// The memory allocated here is not on the GC heap (and it may contain
+// pointers that need to be GC'd), so it has to be traced explicitly. A
+// bitmap per slab records the live blocks and only those are traced.
+// Requests larger than EXEC_MAX_BLOCK, or made when the arena is
+// exhausted, fall back to an mmap of their own, kept on a list.
+
+#define EXEC_SLAB_SIZE      (64 * 1024)
+#define EXEC_MIN_SHIFT      (6)
+#define EXEC_NB_CLASSES     (7)
+#define EXEC_MAX_BLOCK      (1 << (EXEC_MIN_SHIFT + EXEC_NB_CLASSES - 1))
+#define EXEC_SLAB_BLOCKS    (EXEC_SLAB_SIZE >> EXEC_MIN_SHIFT)
+#define EXEC_NB_SLABS       (MICROPY_EXEC_ARENA_SIZE / EXEC_SLAB_SIZE)
+
+typedef struct _exec_slab_t {
+    struct _exec_slab_t *prev, *next; // partial slabs of a class, or unused slabs
+    void *free;         // freed blocks, linked through their first word
+    uint16_t bump;      // blocks below have been handed out before
+    uint16_t nb_used;
+    uint8_t cls;
+    uint32_t live[EXEC_SLAB_BLOCKS / 32];
+} exec_slab_t;
 
 typedef struct _mmap_region_t {
     void *ptr;
@@ -49,38 +75,190 @@ typedef struct _mmap_region_t {
     struct _mmap_region_t *next;
 } mmap_region_t;
 
+STATIC byte *exec_arena;
+STATIC exec_slab_t exec_slabs[EXEC_NB_SLABS];
+STATIC exec_slab_t *exec_unused;                  // slabs without a class
+STATIC exec_slab_t *exec_partial[EXEC_NB_CLASSES]; // slabs with free blocks
+STATIC mmap_region_t *exec_regions;               // fallback mappings
+STATIC size_t exec_nb_live;
+
+STATIC void *exec_mmap(size_t len) {
+    void *ptr = mmap(NULL, len, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+STATIC void exec_list_push(exec_slab_t **head, exec_slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+STATIC void exec_list_del(exec_slab_t **head, exec_slab_t *slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+STATIC bool exec_arena_init(void) {
+    exec_arena = exec_mmap(MICROPY_EXEC_ARENA_SIZE);
+    if (exec_arena == NULL) {
+        return false;
+    }
+    for (int i = EXEC_NB_SLABS - 1; i >= 0; --i) {
+        exec_list_push(&exec_unused, &exec_slabs[i]);
+    }
+    return true;
+}
+
+STATIC inline byte *exec_slab_base(exec_slab_t *slab) {
+    return exec_arena + (slab - exec_slabs) * EXEC_SLAB_SIZE;
+}
+
+STATIC int exec_size_class(size_t size) {
+    int cls = 0;
+    while ((size_t)(1 << (EXEC_MIN_SHIFT + cls)) < size) {
+        ++cls;
+    }
+    return cls;
+}
+
+STATIC void *exec_slab_alloc(int cls) {
+    size_t block_size = 1 << (EXEC_MIN_SHIFT + cls);
+    exec_slab_t *slab = exec_partial[cls];
+    byte *block;
+
+    if (slab == NULL) {
+        if (exec_arena == NULL && !exec_arena_init()) {
+            return NULL;
+        }
+        slab = exec_unused;
+        if (slab == NULL) {
+            return NULL; // arena exhausted
+        }
+        exec_list_del(&exec_unused, slab);
+        memset(slab, 0, sizeof(*slab));
+        slab->cls = cls;
+        exec_list_push(&exec_partial[cls], slab);
+    }
+
+    if (slab->free != NULL) {
+        block = slab->free;
+        slab->free = *(void**)block;
+    } else {
+        block = exec_slab_base(slab) + slab->bump * block_size;
+        ++slab->bump;
+    }
+    if (++slab->nb_used == (EXEC_SLAB_SIZE / block_size)) {
+        exec_list_del(&exec_partial[cls], slab); // full
+    }
+
+    size_t idx = (block - exec_slab_base(slab)) / block_size;
+    slab->live[idx / 32] |= 1u << (idx % 32);
+    // a previous occupant may have left pointers that would keep
+    // objects alive when tracing this block
+    memset(block, 0, block_size);
+    return block;
+}
+
+STATIC void exec_slab_free(void *ptr) {
+    exec_slab_t *slab = &exec_slabs[((byte*)ptr - exec_arena) / EXEC_SLAB_SIZE];
+    size_t block_size = 1 << (EXEC_MIN_SHIFT + slab->cls);
+    size_t idx = ((byte*)ptr - exec_slab_base(slab)) / block_size;
+
+    slab->live[idx / 32] &= ~(1u << (idx % 32));
+    if (slab->nb_used-- == (EXEC_SLAB_SIZE / block_size)) {
+        exec_list_push(&exec_partial[slab->cls], slab); // was full
+    }
+    if (slab->nb_used == 0) {
+        // hand the slab back, it may serve another class next time
+        exec_list_del(&exec_partial[slab->cls], slab);
+        exec_list_push(&exec_unused, slab);
+        return;
+    }
+    *(void**)ptr = slab->free;
+    slab->free = ptr;
+}
+
 void mp_unix_alloc_exec(mp_uint_t min_size, void **ptr, mp_uint_t *size) {
+    if (min_size <= EXEC_MAX_BLOCK) {
+        int cls = exec_size_class(min_size);
+        *ptr = exec_slab_alloc(cls);
+        if (*ptr != NULL) {
+            *size = 1 << (EXEC_MIN_SHIFT + cls);
+            ++exec_nb_live;
+            return;
+        }
+    }
+
     // size needs to be a multiple of the page size
     *size = (min_size + 0xfff) & (~0xfff);
-    *ptr = mmap(NULL, *size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (*ptr == MAP_FAILED) {
-        *ptr = NULL;
+    *ptr = exec_mmap(*size);
+    if (*ptr == NULL) {
+        return;
     }
 
     // add new link to the list of mmap'd regions
-    mmap_region_t *rg = m_new_obj(mmap_region_t);
+    mmap_region_t *rg = malloc(sizeof(mmap_region_t));
+    if (rg == NULL) {
+        munmap(*ptr, *size);
+        *ptr = NULL;
+        return;
+    }
     rg->ptr = *ptr;
     rg->len = min_size;
-    rg->next = MP_STATE_VM(mmap_region_head);
-    MP_STATE_VM(mmap_region_head) = rg;
+    rg->next = exec_regions;
+    exec_regions = rg;
+    ++exec_nb_live;
 }
 
 void mp_unix_free_exec(void *ptr, mp_uint_t size) {
+    --exec_nb_live;
+    if (exec_arena != NULL && (byte*)ptr >= exec_arena && (byte*)ptr < exec_arena + MICROPY_EXEC_ARENA_SIZE) {
+        exec_slab_free(ptr);
+        return;
+    }
+
     munmap(ptr, size);
 
     // unlink the mmap'd region from the list
-    for (mmap_region_t **rg = (mmap_region_t**)&MP_STATE_VM(mmap_region_head); *rg != NULL; *rg = (*rg)->next) {
+    for (mmap_region_t **rg = &exec_regions; *rg != NULL; rg = &(*rg)->next) {
         if ((*rg)->ptr == ptr) {
             mmap_region_t *next = (*rg)->next;
-            m_del_obj(mmap_region_t, *rg);
+            free(*rg);
             *rg = next;
             return;
         }
     }
 }
 
+// Returns true while any native code is allocated
+bool mp_unix_exec_in_use(void) {
+    return exec_nb_live != 0;
+}
+
 void mp_unix_mark_exec(void) {
-    for (mmap_region_t *rg = MP_STATE_VM(mmap_region_head); rg != NULL; rg = rg->next) {
+    for (int i = 0; i < EXEC_NB_SLABS; ++i) {
+        exec_slab_t *slab = &exec_slabs[i];
+        if (slab->nb_used == 0) {
+            continue;
+        }
+        size_t block_size = 1 << (EXEC_MIN_SHIFT + slab->cls);
+        for (size_t w = 0; w < MP_ARRAY_SIZE(slab->live); ++w) {
+            for (uint32_t bits = slab->live[w]; bits != 0; bits &= bits - 1) {
+                size_t idx = w * 32 + __builtin_ctz(bits);
+                gc_collect_root((void**)(exec_slab_base(slab) + idx * block_size), block_size / sizeof(mp_uint_t));
+            }
+        }
+    }
+    for (mmap_region_t *rg = exec_regions; rg != NULL; rg = rg->next) {
         gc_collect_root(rg->ptr, rg->len / sizeof(mp_uint_t));
     }
 }
@@ -0,0 +1,224 @@
+/*
+ * Minipython, a Xen-based Unikernel.
+ *
+ * Authors:  Felipe Huici <felipe.huici@neclab.eu>
+ *           Simon Kuenzer <simon.kuenzer@neclab.eu>
+ *
+ *
+ * Copyright (c) 2013-2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "minipython.h"
+
+#if MICROPY_ALLOC_PROFILE
+
+#include "py/bc.h"
+
+/* Sampling allocation profiler
+ *
+ * py/malloc.c is built with gc_alloc renamed to allocprof_gc_alloc (see
+ * the Makefile), so every heap allocation of the VM passes through
+ * here. Once every allocprof_rate allocated bytes, the C call stack
+ * above the allocator (which names the constructor, hence the object
+ * type, and the runtime function that needed it) is recorded together
+ * with the script being run and the Python function and line that
+ * were executing. The image is built with frame pointers for this.
+ *
+ * The C stack does not tell which Python function is running, so
+ * py/vm.c is also built with mp_execute_bytecode renamed (see the
+ * Makefile): the wrapper below keeps a chain of the code states being
+ * executed. In stackless mode, calls and returns between Python
+ * functions do not go through the wrapper; the VM reports them through
+ * MICROPY_VM_HOOK_INIT instead (see allocprof_enter()).
+ *
+ * Samples are aggregated in a fixed table and dumped as folded stacks
+ * ("script;fun:line;0xaddr;0xaddr bytes" per line, outermost frame
+ * first) which flamegraph.pl takes after symbolizing with
+ * tools/foldsym.py.
+ */
+
+#define ALLOCPROF_DEPTH    6
+#define ALLOCPROF_NB_SLOTS 256
+
+struct allocprof_slot {
+  uint32_t hash;
+  qstr script;
+  qstr fun;       /* MP_QSTR_ if no Python code was running */
+  uint32_t line;
+  void *pc[ALLOCPROF_DEPTH];
+  uint64_t bytes; /* estimated, i.e., samples * rate */
+};
+
+/* One per active mp_execute_bytecode() call, on its C stack */
+struct allocprof_frame {
+  const struct _mp_code_state *code_state;
+  struct allocprof_frame *prev;
+};
+
+STATIC struct allocprof_slot allocprof_table[ALLOCPROF_NB_SLOTS];
+STATIC uint64_t allocprof_dropped; /* bytes of samples that did not fit */
+STATIC mp_int_t allocprof_countdown;
+STATIC struct allocprof_frame *allocprof_frames;
+size_t allocprof_rate; /* 0: disabled */
+
+mp_vm_return_kind_t allocprof_vm_execute_bytecode(struct _mp_code_state *code_state,
+                                                  volatile mp_obj_t inject_exc);
+
+/* The VM catches every exception raised while it runs and returns
+ * MP_VM_RETURN_EXCEPTION, so the frame is always unlinked here */
+mp_vm_return_kind_t mp_execute_bytecode(struct _mp_code_state *code_state,
+                                        volatile mp_obj_t inject_exc)
+{
+  struct allocprof_frame frame = { code_state, allocprof_frames };
+  mp_vm_return_kind_t ret;
+
+  allocprof_frames = &frame;
+  ret = allocprof_vm_execute_bytecode(code_state, inject_exc);
+  allocprof_frames = frame.prev;
+  return ret;
+}
+
+#if MICROPY_STACKLESS
+/* Called by the VM whenever it switches to another code state */
+void allocprof_enter(const struct _mp_code_state *code_state)
+{
+  if (allocprof_frames)
+    allocprof_frames->code_state = code_state;
+}
+#endif
+
+/* Returns the frame above fp, or NULL when fp is the outermost one */
+STATIC inline void **allocprof_next_frame(void **fp)
+{
+  void **next = *fp;
+
+  if (next <= fp || (void *) next >= MP_STATE_VM(stack_top))
+    return NULL;
+  return next;
+}
+
+/* Not inlined: the frame walk below counts on its own frame */
+STATIC __attribute__((noinline)) void allocprof_record(void)
+{
+  struct allocprof_slot *slot;
+  void *pc[ALLOCPROF_DEPTH] = { NULL };
+  void **fp;
+  uint32_t h = current_script;
+  qstr fun = MP_QSTR_;
+  uint32_t line = 0;
+  unsigned int i;
+
+  if (allocprof_frames) {
+    fun = mp_obj_fun_get_name(MP_OBJ_FROM_PTR(allocprof_frames->code_state->fun_bc));
+    line = vm_source_line(allocprof_frames->code_state);
+    h = ((h ^ fun) * 16777619u ^ line) * 16777619u;
+  }
+
+  /* skip our frame and the one of allocprof_gc_alloc(): the return
+   * address of the m_malloc() variant's frame is the allocating site */
+  fp = __builtin_frame_address(0);
+  for (i = 0; fp && i < 2; ++i)
+    fp = allocprof_next_frame(fp);
+  for (i = 0; fp && i < ALLOCPROF_DEPTH; ++i) {
+    pc[i] = fp[1];
+    h = (h ^ (uint32_t) (uintptr_t) pc[i]) * 16777619u;
+    fp = allocprof_next_frame(fp);
+  }
+
+  for (i = 0; i < ALLOCPROF_NB_SLOTS; ++i) {
+    slot = &allocprof_table[(h + i) % ALLOCPROF_NB_SLOTS];
+    if (slot->bytes == 0) {
+      slot->hash = h;
+      slot->script = current_script;
+      slot->fun = fun;
+      slot->line = line;
+      memcpy(slot->pc, pc, sizeof(pc));
+    } else if (slot->hash != h || slot->script != current_script ||
+               slot->fun != fun || slot->line != line ||
+               memcmp(slot->pc, pc, sizeof(pc)) != 0) {
+      continue;
+    }
+    slot->bytes += allocprof_rate;
+    return;
+  }
+  allocprof_dropped += allocprof_rate;
+}
+
+void *allocprof_gc_alloc(size_t n_bytes, bool has_finaliser)
+{
+  if (allocprof_rate) {
+    allocprof_countdown -= n_bytes;
+    while (allocprof_countdown <= 0) {
+      allocprof_countdown += allocprof_rate;
+      allocprof_record();
+    }
+  }
+  return gc_alloc_counted(n_bytes, has_finaliser);
+}
+
+/* Starts sampling every rate bytes (0 stops) and clears the table */
+void allocprof_start(size_t rate)
+{
+  memset(allocprof_table, 0, sizeof(allocprof_table));
+  allocprof_dropped = 0;
+  allocprof_countdown = rate;
+  allocprof_rate = rate;
+}
+
+/* Writes the folded stacks through print; returns the number of lines.
+ * Addresses are printed as 32 bits, which covers the text of the image
+ * (Mini-OS links it at the bottom of the address space). */
+unsigned int allocprof_dump(const mp_print_t *print)
+{
+  struct allocprof_slot *slot;
+  unsigned int i, n = 0;
+  int d;
+
+  for (i = 0; i < ALLOCPROF_NB_SLOTS; ++i) {
+    slot = &allocprof_table[i];
+    if (slot->bytes == 0)
+      continue;
+    mp_printf(print, "%s", slot->script == MP_QSTR_ ? "-" : qstr_str(slot->script));
+    if (slot->fun != MP_QSTR_)
+      mp_printf(print, ";%s:%u", qstr_str(slot->fun), (unsigned int) slot->line);
+    for (d = ALLOCPROF_DEPTH - 1; d >= 0; --d) {
+      if (slot->pc[d])
+        mp_printf(print, ";0x%08x", (unsigned int) (uintptr_t) slot->pc[d]);
+    }
+    mp_printf(print, " %lu\n", (unsigned long) slot->bytes);
+    ++n;
+  }
+  if (allocprof_dropped) {
+    mp_printf(print, "[dropped] %lu\n", (unsigned long) allocprof_dropped);
+    ++n;
+  }
+  return n;
+}
+
+#endif /* MICROPY_ALLOC_PROFILE */
@@ -0,0 +1,146 @@
+/*
+ * Minipython, a Xen-based Unikernel.
+ *
+ * Authors:  Felipe Huici <felipe.huici@neclab.eu>
+ *           Simon Kuenzer <simon.kuenzer@neclab.eu>
+ *
+ *
+ * Copyright (c) 2013-2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "minipython.h"
+#include "bootprof.h"
+
+#include <mini-os/time.h>
+#include <sys/time.h>
+
+#define BOOTPROF_MAX_MARKS 24
+
+struct bootprof_mark {
+  const char *phase;
+  s_time_t t;
+};
+
+STATIC struct bootprof_mark bootprof_marks[BOOTPROF_MAX_MARKS];
+STATIC unsigned int bootprof_nb_marks = 0;
+STATIC bool bootprof_closed = false;
+STATIC s_time_t bootprof_start = -1; /* system time of domain creation */
+
+void bootprof_mark(const char *phase)
+{
+  if (bootprof_closed || bootprof_nb_marks == BOOTPROF_MAX_MARKS)
+    return;
+  bootprof_marks[bootprof_nb_marks].phase = phase;
+  bootprof_marks[bootprof_nb_marks].t = NOW();
+  ++bootprof_nb_marks;
+}
+
+/* Returns the system time at which the toolstack created the domain.
+ * Xen system time counts from the boot of the host, so the wall-clock
+ * start_time that xl stores in the vm path of the domain is translated
+ * with the current offset between both clocks. Without it, the first
+ * mark is the origin. */
+STATIC s_time_t bootprof_domain_start(void)
+{
+  char path[64];
+  char *vm, *val, *err, *frac;
+  struct timeval tv;
+  s_time_t wall, start, scale;
+  int i;
+
+  if (bootprof_start >= 0)
+    return bootprof_start;
+  bootprof_start = bootprof_nb_marks ? bootprof_marks[0].t : 0;
+
+  err = xenbus_read(XBT_NIL, "vm", &vm);
+  if (err) {
+    free(err);
+    return bootprof_start;
+  }
+  snprintf(path, sizeof(path), "%s/start_time", vm);
+  free(vm);
+  err = xenbus_read(XBT_NIL, path, &val);
+  if (err) {
+    free(err);
+    return bootprof_start;
+  }
+
+  /* "<seconds>.<fraction>" */
+  start = (s_time_t) strtoull(val, &frac, 10) * 1000000000LL;
+  if (*frac == '.') {
+    scale = 100000000LL;
+    for (i = 1; frac[i] >= '0' && frac[i] <= '9' && scale; ++i, scale /= 10)
+      start += (frac[i] - '0') * scale;
+  }
+  free(val);
+
+  gettimeofday(&tv, NULL);
+  wall = (s_time_t) tv.tv_sec * 1000000000LL + (s_time_t) tv.tv_usec * 1000;
+  start = NOW() - (wall - start);
+  /* ignore clock skew that would put creation after the first mark */
+  if (start > 0 && start <= bootprof_start)
+    bootprof_start = start;
+  return bootprof_start;
+}
+
+STATIC unsigned long bootprof_usecs(unsigned int i)
+{
+  return (unsigned long) ((bootprof_marks[i].t - bootprof_domain_start()) / 1000);
+}
+
+void bootprof_close(void)
+{
+#if BOOT_PROFILE_PRINT
+  unsigned int i;
+#endif
+
+  if (bootprof_closed)
+    return;
+  bootprof_closed = true;
+#if BOOT_PROFILE_PRINT
+  printk("bootprof:");
+  for (i = 0; i < bootprof_nb_marks; ++i)
+    printk(" %s=%lu", bootprof_marks[i].phase, bootprof_usecs(i));
+  printk("\n");
+#endif
+}
+
+/* Returns the marks as a dict mapping each phase to its time in
+ * microseconds since the domain was created */
+mp_obj_t bootprof_dict(void)
+{
+  mp_obj_t dict = mp_obj_new_dict(bootprof_nb_marks);
+  unsigned int i;
+
+  for (i = 0; i < bootprof_nb_marks; ++i)
+    mp_obj_dict_store(dict,
+                      MP_OBJ_NEW_QSTR(qstr_from_str(bootprof_marks[i].phase)),
+                      mp_obj_new_int_from_uint(bootprof_usecs(i)));
+  return dict;
+}
@@ -3,6 +3,7 @@
 /*-----------------------------------------------------------------------*/
 #include "diskio.h"		/* FatFs lower layer API      */
 #include "blkdev.h"             /* MiniOS block device driver */
+#include "bootprof.h"           /* boot-phase timestamps      */
 
 #define XEN_XVDA_DEVID 51712
 
@@ -31,6 +32,7 @@ DSTATUS disk_initialize (
 {
         bd = open_blkdev((blkdev_id_t)pdrv * 16 + XEN_XVDA_DEVID, O_RDWR);
 	if (!bd) return STA_NOINIT;
+	bootprof_mark("fat_blkdev");
 	return RES_OK;
 }
  
@@ -0,0 +1,467 @@
+/*
+ * Minipython, a Xen-based Unikernel.
+ *
+ * Authors:  Felipe Huici <felipe.huici@neclab.eu>
+ *           Simon Kuenzer <simon.kuenzer@neclab.eu>
+ *
+ *
+ * Copyright (c) 2013-2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <mini-os/os.h>
+#include <mini-os/time.h>
+#include <mini-os/sched.h>
+#include <mini-os/wait.h>
+#include <errno.h>
+#ifdef HAVE_LIBC
+#include <mini-os/blkfront.h>
+#include <mini-os/console.h>
+#endif
+#include "minipython.h"
+#include "evloop.h"
+
+/* Event loop
+ *
+ * All waiting in the unikernel goes through this file. Drivers register
+ * readiness sources (netfront via modlwip, blkfront via SHFS) that are
+ * polled on every iteration; when none of them has work, the application
+ * thread sleeps until the next timer deadline or until a driver wakes it
+ * up, instead of spinning on the rings. It never blocks the domain
+ * itself: other Mini-OS threads (xenbus, the front-ends) keep running,
+ * and the idle thread blocks the vCPU once nothing is runnable.
+ *
+ * For the wake-ups, the thread stays on the wait queues of blkfront
+ * and the console, whose event handlers call wake_up(), which also
+ * clears the thread's wakeup_time. evloop_poll() sets wakeup_time
+ * before polling, so evloop_block() finds it cleared when an event came
+ * in after the poll started and returns right away. netfront does not
+ * wake anyone on the lwIP netif path (only its tap device does), so
+ * while it is registered sleeping is cut to MICROPY_EVLOOP_SLICE_MS;
+ * otherwise an idle thread sleeps up to MICROPY_EVLOOP_MAX_BLOCK_MS or
+ * the next ticker deadline.
+ *
+ * Drivers with timeouts of their own (lwIP) register a ticker instead:
+ * it is run after a poll once its deadline has passed, and sleeping
+ * never extends past the earliest ticker deadline. Tickers never run
+ * from within bytecode, only where Python waits: blocking socket calls,
+ * sleeps (mp_hal_delay_ms(), time.sleep()) and explicit polls. Sources
+ * and tickers do not nest, since lwIP is not reentrant.
+ *
+ * On top of that sits the scheduler used by uasyncio: a FIFO run queue,
+ * a binary min-heap of timers and a list of objects waiting for socket
+ * readiness. All three live on the GC heap and are reachable through
+ * root pointers, so queued coroutines are never collected. Waiters are
+ * one-shot: an object is moved to the run queue when its socket becomes
+ * ready and has to wait again afterwards.
+ */
+
+struct _evloop_timer_t {
+  mp_uint_t when; /* ms, see mp_hal_ticks_ms() */
+  mp_uint_t seq;  /* keeps timers with equal deadlines in FIFO order */
+  mp_obj_t obj;
+};
+
+struct _evloop_io_t {
+  mp_obj_t sock;
+  mp_uint_t flags;
+  mp_obj_t obj;
+};
+
+STATIC void (*evloop_sources[MICROPY_EVLOOP_MAX_SOURCES])(void);
+STATIC unsigned int evloop_nb_sources;
+STATIC unsigned int evloop_nb_unwoken; /* sources that never wake us */
+STATIC mp_uint_t (*evloop_tickers[MICROPY_EVLOOP_MAX_SOURCES])(void);
+STATIC mp_uint_t evloop_tickers_due[MICROPY_EVLOOP_MAX_SOURCES];
+STATIC unsigned int evloop_nb_tickers;
+STATIC mp_uint_t evloop_tick_due; /* earliest of evloop_tickers_due */
+STATIC bool evloop_busy;          /* running a source or ticker */
+#ifdef HAVE_LIBC
+STATIC struct wait_queue evloop_waiters[2];
+STATIC bool evloop_waiting;       /* evloop_waiters are queued */
+#endif
+
+/* wakeup_time of the application thread while it runs; wake() resets
+ * it to 0 */
+#define EVLOOP_ARMED ((s_time_t) 1)
+
+STATIC size_t runq_alloc, runq_head, runq_len;
+STATIC size_t timers_alloc, timers_len;
+STATIC size_t io_alloc, io_len;
+STATIC mp_uint_t timers_seq;
+
+#define EVLOOP_MIN_ALLOC 16
+#define TIMER_BEFORE(a, b) \
+  ((mp_int_t)((a)->when - (b)->when) < 0 || \
+   ((a)->when == (b)->when && (mp_int_t)((a)->seq - (b)->seq) < 0))
+
+void evloop_add_source(void (*poll)(void), bool wakes)
+{
+  unsigned int i;
+
+  for (i = 0; i < evloop_nb_sources; ++i)
+    if (evloop_sources[i] == poll)
+      return;
+  if (evloop_nb_sources == MICROPY_EVLOOP_MAX_SOURCES) {
+    printk("evloop: too many sources, ignoring %p\n", poll);
+    return;
+  }
+  evloop_sources[evloop_nb_sources++] = poll;
+  if (!wakes)
+    ++evloop_nb_unwoken;
+}
+
+void evloop_add_ticker(mp_uint_t (*tick)(void))
+{
+  unsigned int i;
+
+  for (i = 0; i < evloop_nb_tickers; ++i)
+    if (evloop_tickers[i] == tick)
+      return;
+  if (evloop_nb_tickers == MICROPY_EVLOOP_MAX_SOURCES) {
+    printk("evloop: too many tickers, ignoring %p\n", tick);
+    return;
+  }
+  evloop_tickers_due[evloop_nb_tickers] = mp_hal_ticks_ms();
+  evloop_tickers[evloop_nb_tickers++] = tick;
+  evloop_tick_due = mp_hal_ticks_ms();
+}
+
+STATIC void evloop_tick(void)
+{
+  mp_uint_t now, next;
+  unsigned int i;
+
+  if (!evloop_nb_tickers || evloop_busy)
+    return;
+  now = mp_hal_ticks_ms();
+  if ((mp_int_t)(evloop_tick_due - now) > 0)
+    return;
+
+  evloop_busy = true;
+  next = now + MICROPY_EVLOOP_MAX_BLOCK_MS;
+  for (i = 0; i < evloop_nb_tickers; ++i) {
+    if ((mp_int_t)(evloop_tickers_due[i] - now) <= 0)
+      evloop_tickers_due[i] = now + evloop_tickers[i]();
+    if ((mp_int_t)(evloop_tickers_due[i] - next) < 0)
+      next = evloop_tickers_due[i];
+  }
+  evloop_tick_due = next;
+  evloop_busy = false;
+}
+
+void evloop_poll(void)
+{
+  unsigned int i;
+
+  if (evloop_busy)
+    return;
+  gc_collect_idle();
+  get_current()->wakeup_time = EVLOOP_ARMED;
+  evloop_busy = true;
+  for (i = 0; i < evloop_nb_sources; ++i)
+    evloop_sources[i]();
+  evloop_busy = false;
+  evloop_tick();
+}
+
+void evloop_block(mp_uint_t ms)
+{
+  unsigned long flags;
+
+  if (ms > MICROPY_EVLOOP_MAX_BLOCK_MS)
+    ms = MICROPY_EVLOOP_MAX_BLOCK_MS;
+  if (evloop_nb_tickers) {
+    mp_int_t d = (mp_int_t)(evloop_tick_due - mp_hal_ticks_ms());
+    if (d < 0)
+      d = 0;
+    if ((mp_uint_t) d < ms)
+      ms = d;
+  }
+  if (evloop_nb_unwoken && ms > MICROPY_EVLOOP_SLICE_MS)
+    ms = MICROPY_EVLOOP_SLICE_MS;
+
+  local_irq_save(flags);
+  if (get_current()->wakeup_time != 0) { /* no wake-up since the poll */
+    get_current()->wakeup_time = NOW() + MILLISECS(ms);
+    clear_runnable(get_current());
+  }
+  local_irq_restore(flags);
+  /* runs the other threads, or the idle thread that blocks the domain */
+  schedule();
+}
+
+/* Waiting from within a source or ticker (e.g., a socket call in a
+ * Python callback run by lwIP) could never see the condition change,
+ * since the sources are not polled again until it returns */
+void evloop_check_busy(void)
+{
+  if (evloop_busy)
+    nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError,
+                                        MP_OBJ_NEW_SMALL_INT(EWOULDBLOCK)));
+}
+
+void evloop_check_pending(void)
+{
+  mp_obj_t obj = MP_STATE_VM(mp_pending_exception);
+
+  if (obj != MP_OBJ_NULL) {
+    MP_STATE_VM(mp_pending_exception) = MP_OBJ_NULL;
+    nlr_raise(obj);
+  }
+}
+
+STATIC bool evloop_wait_until(bool (*done)(void *arg), void *arg, mp_int_t timeout_ms,
+                              bool interruptible)
+{
+  mp_uint_t start = mp_hal_ticks_ms();
+  mp_uint_t ms;
+  mp_int_t left = 0;
+
+  for (;;) {
+    evloop_poll();
+    if (done(arg))
+      return true;
+    if (timeout_ms >= 0) {
+      left = timeout_ms - (mp_int_t)(mp_hal_ticks_ms() - start);
+      if (left <= 0)
+        return false;
+    }
+    evloop_check_busy();
+    if (interruptible)
+      evloop_check_pending();
+
+    ms = MICROPY_EVLOOP_MAX_BLOCK_MS;
+    if (timeout_ms >= 0 && (mp_uint_t) left < ms)
+      ms = left;
+    evloop_block(ms);
+  }
+}
+
+bool evloop_wait(bool (*done)(void *arg), void *arg, mp_int_t timeout_ms)
+{
+  return evloop_wait_until(done, arg, timeout_ms, true);
+}
+
+bool evloop_wait_nointr(bool (*done)(void *arg), void *arg, mp_int_t timeout_ms)
+{
+  return evloop_wait_until(done, arg, timeout_ms, false);
+}
+
+STATIC bool evloop_never(void *arg)
+{
+  return false;
+}
+
+void evloop_delay_ms(mp_uint_t ms)
+{
+  if (evloop_busy) {
+    msleep(ms); /* in a callback of a source: nothing to poll */
+    return;
+  }
+  evloop_wait(evloop_never, NULL, ms);
+}
+
+void evloop_init(void)
+{
+#ifdef HAVE_LIBC
+  if (!evloop_waiting) {
+    struct wait_queue_head *wq[2] = { &blkfront_queue, &console_queue };
+    unsigned int i;
+
+    for (i = 0; i < 2; ++i) {
+      DEFINE_WAIT(w);
+      evloop_waiters[i] = w;
+      add_wait_queue(wq[i], &evloop_waiters[i]);
+    }
+    evloop_waiting = true;
+  }
+#endif
+  MP_STATE_PORT(evloop_runq) = NULL;
+  MP_STATE_PORT(evloop_timers) = NULL;
+  MP_STATE_PORT(evloop_io) = NULL;
+  runq_alloc = runq_head = runq_len = 0;
+  timers_alloc = timers_len = 0;
+  io_alloc = io_len = 0;
+}
+
+void evloop_call_soon(mp_obj_t obj)
+{
+  mp_obj_t *q = MP_STATE_PORT(evloop_runq);
+  size_t i, n;
+
+  if (runq_len == runq_alloc) {
+    /* unwrap the ring into a larger array */
+    n = runq_alloc ? runq_alloc * 2 : EVLOOP_MIN_ALLOC;
+    mp_obj_t *nq = m_new(mp_obj_t, n);
+    for (i = 0; i < runq_len; ++i)
+      nq[i] = q[(runq_head + i) % runq_alloc];
+    m_del(mp_obj_t, q, runq_alloc);
+    MP_STATE_PORT(evloop_runq) = q = nq;
+    runq_alloc = n;
+    runq_head = 0;
+  }
+  q[(runq_head + runq_len) % runq_alloc] = obj;
+  ++runq_len;
+}
+
+STATIC mp_obj_t evloop_runq_pop(void)
+{
+  mp_obj_t *q = MP_STATE_PORT(evloop_runq);
+  mp_obj_t obj = q[runq_head];
+
+  q[runq_head] = MP_OBJ_NULL; /* do not keep it alive */
+  runq_head = (runq_head + 1) % runq_alloc;
+  --runq_len;
+  return obj;
+}
+
+void evloop_call_at(mp_uint_t when_ms, mp_obj_t obj)
+{
+  struct _evloop_timer_t *h = MP_STATE_PORT(evloop_timers);
+  struct _evloop_timer_t t = { when_ms, timers_seq++, obj };
+  size_t i, parent;
+
+  if (timers_len == timers_alloc) {
+    size_t n = timers_alloc ? timers_alloc * 2 : EVLOOP_MIN_ALLOC;
+    MP_STATE_PORT(evloop_timers) = h = m_renew(struct _evloop_timer_t, h, timers_alloc, n);
+    timers_alloc = n;
+  }
+  /* sift up */
+  for (i = timers_len++; i > 0; i = parent) {
+    parent = (i - 1) / 2;
+    if (!TIMER_BEFORE(&t, &h[parent]))
+      break;
+    h[i] = h[parent];
+  }
+  h[i] = t;
+}
+
+STATIC mp_obj_t evloop_timers_pop(void)
+{
+  struct _evloop_timer_t *h = MP_STATE_PORT(evloop_timers);
+  struct _evloop_timer_t last;
+  mp_obj_t obj = h[0].obj;
+  size_t i, child;
+
+  last = h[--timers_len];
+  /* sift down */
+  for (i = 0; (child = 2 * i + 1) < timers_len; i = child) {
+    if (child + 1 < timers_len && TIMER_BEFORE(&h[child + 1], &h[child]))
+      ++child;
+    if (!TIMER_BEFORE(&h[child], &last))
+      break;
+    h[i] = h[child];
+  }
+  h[i] = last;
+  h[timers_len].obj = MP_OBJ_NULL;
+  return obj;
+}
+
+void evloop_wait_io(mp_obj_t sock, mp_uint_t flags, mp_obj_t obj)
+{
+  struct _evloop_io_t *w = MP_STATE_PORT(evloop_io);
+
+  if (io_len == io_alloc) {
+    size_t n = io_alloc ? io_alloc * 2 : EVLOOP_MIN_ALLOC;
+    MP_STATE_PORT(evloop_io) = w = m_renew(struct _evloop_io_t, w, io_alloc, n);
+    io_alloc = n;
+  }
+  w[io_len].sock = sock;
+  w[io_len].flags = flags;
+  w[io_len].obj = obj;
+  ++io_len;
+}
+
+STATIC void evloop_io_del(size_t i)
+{
+  struct _evloop_io_t *w = MP_STATE_PORT(evloop_io);
+
+  w[i] = w[--io_len];
+  w[io_len].sock = w[io_len].obj = MP_OBJ_NULL;
+}
+
+void evloop_remove_io(mp_obj_t sock)
+{
+  struct _evloop_io_t *w = MP_STATE_PORT(evloop_io);
+  size_t i = 0;
+
+  while (i < io_len) {
+    if (w[i].sock == sock)
+      evloop_io_del(i); /* moves the last waiter to i */
+    else
+      ++i;
+  }
+}
+
+/* Moves waiters of ready sockets and expired timers to the run queue */
+STATIC void evloop_dispatch(void)
+{
+  struct _evloop_io_t *w = MP_STATE_PORT(evloop_io);
+  struct _evloop_timer_t *h = MP_STATE_PORT(evloop_timers);
+  mp_uint_t now = mp_hal_ticks_ms();
+  size_t i = 0;
+
+  while (i < io_len) {
+    if (lwip_socket_poll(w[i].sock, w[i].flags)) {
+      evloop_call_soon(w[i].obj);
+      evloop_io_del(i);
+    } else {
+      ++i;
+    }
+  }
+  while (timers_len && (mp_int_t)(h[0].when - now) <= 0)
+    evloop_call_soon(evloop_timers_pop());
+}
+
+mp_obj_t evloop_next(void)
+{
+  mp_uint_t timeout;
+
+  for (;;) {
+    evloop_poll();
+    evloop_dispatch();
+    if (runq_len)
+      return evloop_runq_pop();
+    if (!timers_len && !io_len)
+      return MP_OBJ_NULL;
+
+    evloop_check_busy();
+    evloop_check_pending();
+
+    timeout = MICROPY_EVLOOP_MAX_BLOCK_MS;
+    if (timers_len) {
+      mp_int_t d = (mp_int_t)(MP_STATE_PORT(evloop_timers)[0].when - mp_hal_ticks_ms());
+      if (d <= 0)
+        continue;
+      if ((mp_uint_t) d < timeout)
+        timeout = d;
+    }
+    evloop_block(timeout);
+  }
+}
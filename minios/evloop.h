@@ -0,0 +1,122 @@
+/*
+ * Minipython, a Xen-based Unikernel.
+ *
+ * Authors:  Felipe Huici <felipe.huici@neclab.eu>
+ *           Simon Kuenzer <simon.kuenzer@neclab.eu>
+ *
+ *
+ * Copyright (c) 2013-2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _EVLOOP_H_
+#define _EVLOOP_H_
+
+#include "py/obj.h"
+
+/* Readiness flags of evloop_wait_io(); same values as select.poll() */
+#define EVLOOP_IO_RD  (0x0001)
+#define EVLOOP_IO_WR  (0x0004)
+#define EVLOOP_IO_ERR (0x0008)
+#define EVLOOP_IO_HUP (0x0010)
+
+/* Registers a readiness source: poll is called on every iteration of
+ * the loop and by every blocking wait (e.g., netfront or blkfront ring
+ * processing). wakes tells whether the front-end wakes up its wait
+ * queue on new work; if not, sleeps are cut to MICROPY_EVLOOP_SLICE_MS.
+ * Registering the same function twice has no effect. */
+void evloop_add_source(void (*poll)(void), bool wakes);
+
+/* Registers a timer service for a driver's own timeouts (e.g., lwIP's
+ * TCP retransmissions): tick is called once its deadline has passed and
+ * returns in how many ms it wants to be called again. Tickers run from
+ * evloop_poll(), never from within bytecode, and waits never sleep past
+ * their next deadline. */
+void evloop_add_ticker(mp_uint_t (*tick)(void));
+
+/* Polls all registered sources once (and collects garbage if idle),
+ * then runs the tickers that are due. Does nothing when called from
+ * within a source, e.g., by a Python callback run by lwIP. */
+void evloop_poll(void);
+
+/* Puts the application thread to sleep for at most ms milliseconds
+ * (MICROPY_EVLOOP_SLICE_MS while a source that does not wake its queue
+ * is registered), or until a
+ * driver wakes it up; returns at once when that happened since the last
+ * evloop_poll(). Other threads run meanwhile; the vCPU is blocked by the
+ * idle thread. */
+void evloop_block(mp_uint_t ms);
+
+/* Raises the pending exception (e.g., KeyboardInterrupt), if any; for
+ * loops that wait without running bytecode */
+void evloop_check_pending(void);
+
+/* Raises OSError(EWOULDBLOCK) when called from within a source or
+ * ticker, where waiting for an event would never end */
+void evloop_check_busy(void);
+
+/* Polls the sources until done(arg) holds, sleeping between
+ * polls, or until timeout_ms passed (no limit if negative). Returns
+ * the last result of done(). A source whose callback changes the state
+ * that done() checks is noticed right after its driver wakes us up.
+ * Raises OSError(EWOULDBLOCK) instead of waiting when called from
+ * within a source or ticker, e.g., from a Python callback of lwIP. */
+bool evloop_wait(bool (*done)(void *arg), void *arg, mp_int_t timeout_ms);
+
+/* Same as evloop_wait(), but leaves pending exceptions (e.g., Ctrl-C)
+ * for the caller to raise once done; for waits on state that a driver
+ * still references until it calls back */
+bool evloop_wait_nointr(bool (*done)(void *arg), void *arg, mp_int_t timeout_ms);
+
+/* Sleeps for ms milliseconds while polling the sources and running
+ * the tickers (mp_hal_delay_ms(), time.sleep()); raises the pending
+ * exception, if any */
+void evloop_delay_ms(mp_uint_t ms);
+
+/* Run queue, timer heap and I/O waiters of the Python-level loop.
+ * Entries are arbitrary objects (coroutines or callbacks) that are
+ * handed back by evloop_next() once runnable. evloop_init() must be
+ * called from the application thread, which it puts on the drivers'
+ * wait queues. */
+void evloop_init(void);
+void evloop_call_soon(mp_obj_t obj);
+void evloop_call_at(mp_uint_t when_ms, mp_obj_t obj);
+void evloop_wait_io(mp_obj_t sock, mp_uint_t flags, mp_obj_t obj);
+void evloop_remove_io(mp_obj_t sock);
+
+/* Returns the next runnable object, blocking until a timer expires or
+ * a socket becomes ready (raising OSError(EWOULDBLOCK) within a source,
+ * like evloop_wait()). Returns MP_OBJ_NULL when nothing is queued,
+ * no timer is pending and no socket is waited for. */
+mp_obj_t evloop_next(void);
+
+/* Returns the subset of flags (plus EVLOOP_IO_ERR/HUP) for which the
+ * lwIP socket sock is ready; see mods/modlwip.c */
+mp_uint_t lwip_socket_poll(mp_obj_t sock, mp_uint_t flags);
+
+#endif /* _EVLOOP_H_ */
@@ -1,6 +1,141 @@
 #include "lib/fatfs/ff.h"
 #include "lib/fatfs/diskio.h"
+#include "minipython.h"
+#include <sys/time.h>
+#include <time.h>
 
+// Timestamps of created and written files (UTC); tiering relies on
+// modification times changing when a script is rewritten
 DWORD get_fattime(void) {
-    return 0;
+    struct timeval tv;
+    struct tm *tm;
+
+    gettimeofday(&tv, NULL);
+    tm = gmtime(&tv.tv_sec);
+    if (tm == NULL || tm->tm_year < 80) {
+        return (DWORD)(1 << 21) | (1 << 16); // 1980-01-01, FAT epoch
+    }
+    return ((DWORD)(tm->tm_year - 80) << 25) |
+           ((DWORD)(tm->tm_mon + 1) << 21) |
+           ((DWORD)tm->tm_mday << 16) |
+           ((DWORD)tm->tm_hour << 11) |
+           ((DWORD)tm->tm_min << 5) |
+           ((DWORD)tm->tm_sec >> 1);
+}
+
+// lib/fatfs/ff.o is built with the FatFs calls below renamed to
+// fatfs_<name> (see the Makefile), so every caller (uos, uos.VfsFat,
+// open(), the .mpy cache, mounting) passes through here. Calls that may
+// add, remove or rename directory entries, or change what relative
+// paths refer to, make cached import lookups stale.
+
+STATIC void fatfs_changed(void) {
+    #if MICROPY_IMPORT_STAT_CACHE
+    import_stat_cache_invalidate();
+    #endif
+}
+
+// The .mpy cache directory is never on sys.path, so the entries written
+// there on every cache miss (see mpycache.c) leave import lookups alone.
+// Creating the directory itself still counts, as it shows up in the
+// listing of its parent.
+STATIC bool fatfs_in_cache_dir(const TCHAR *path) {
+    #if MICROPY_MPY_CACHE
+    size_t n = strlen(MICROPY_MPY_CACHE_DIR);
+    return strncmp(path, MICROPY_MPY_CACHE_DIR, n) == 0 && path[n] == '/';
+    #else
+    return false;
+    #endif
+}
+
+FRESULT fatfs_f_open(FIL *fp, const TCHAR *path, BYTE mode);
+FRESULT fatfs_f_mount(FATFS *fs, const TCHAR *path, BYTE opt);
+
+// Opening with a create flag only adds an entry when the file did not
+// exist yet; appends and rewrites of existing files leave the cache alone
+FRESULT f_open(FIL *fp, const TCHAR *path, BYTE mode) {
+    bool created = false;
+    if ((mode & (FA_CREATE_NEW | FA_CREATE_ALWAYS | FA_OPEN_ALWAYS)) && !fatfs_in_cache_dir(path)) {
+        FILINFO fno;
+        #if _USE_LFN
+        fno.lfname = NULL;
+        fno.lfsize = 0;
+        #endif
+        created = f_stat(path, &fno) == FR_NO_FILE;
+    }
+    FRESULT res = fatfs_f_open(fp, path, mode);
+    if (res == FR_OK && created) {
+        fatfs_changed();
+    }
+    return res;
+}
+
+FRESULT f_mount(FATFS *fs, const TCHAR *path, BYTE opt) {
+    FRESULT res = fatfs_f_mount(fs, path, opt);
+    fatfs_changed();
+    return res;
+}
+
+#if !_FS_READONLY
+FRESULT fatfs_f_unlink(const TCHAR *path);
+FRESULT fatfs_f_rename(const TCHAR *path_old, const TCHAR *path_new);
+FRESULT fatfs_f_mkdir(const TCHAR *path);
+
+FRESULT f_unlink(const TCHAR *path) {
+    FRESULT res = fatfs_f_unlink(path);
+    if (res == FR_OK && !fatfs_in_cache_dir(path)) {
+        fatfs_changed();
+    }
+    return res;
+}
+
+FRESULT f_rename(const TCHAR *path_old, const TCHAR *path_new) {
+    FRESULT res = fatfs_f_rename(path_old, path_new);
+    if (res == FR_OK && !(fatfs_in_cache_dir(path_old) && fatfs_in_cache_dir(path_new))) {
+        fatfs_changed();
+    }
+    return res;
+}
+
+FRESULT f_mkdir(const TCHAR *path) {
+    FRESULT res = fatfs_f_mkdir(path);
+    if (res == FR_OK) {
+        fatfs_changed();
+    }
+    return res;
+}
+#endif
+
+#if _USE_MKFS && !_FS_READONLY
+FRESULT fatfs_f_mkfs(const TCHAR *path, BYTE sfd, UINT au);
+
+FRESULT f_mkfs(const TCHAR *path, BYTE sfd, UINT au) {
+    FRESULT res = fatfs_f_mkfs(path, sfd, au);
+    fatfs_changed();
+    return res;
+}
+#endif
+
+#if _FS_RPATH >= 1
+FRESULT fatfs_f_chdir(const TCHAR *path);
+
+FRESULT f_chdir(const TCHAR *path) {
+    FRESULT res = fatfs_f_chdir(path);
+    if (res == FR_OK) {
+        fatfs_changed();
+    }
+    return res;
+}
+
+#if _VOLUMES >= 2
+FRESULT fatfs_f_chdrive(const TCHAR *path);
+
+FRESULT f_chdrive(const TCHAR *path) {
+    FRESULT res = fatfs_f_chdrive(path);
+    if (res == FR_OK) {
+        fatfs_changed();
+    }
+    return res;
 }
+#endif
+#endif
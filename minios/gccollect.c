@@ -28,6 +28,11 @@
 
 #include "py/mpstate.h"
 #include "py/gc.h"
+#include "py/mphal.h"
+#include "minipython.h"
+#if MICROPY_GC_STATS
+#include <mini-os/time.h>
+#endif
 
 #if MICROPY_ENABLE_GC
 
@@ -138,13 +143,75 @@ STATIC void gc_helper_get_regs(regs_t arr) {
 
 #endif // MICROPY_GCREGS_SETJMP
 
+#if MICROPY_GC_STATS
+struct gc_stats gc_stats;
+
+// used_before is the estimate of gc_collect_idle(), so reclaimed bytes
+// include memory freed explicitly since the last collection
+STATIC void gc_stats_record(size_t used_before, const gc_info_t *after, s_time_t pause) {
+    struct gc_stats_sample *s = &gc_stats.ring[gc_stats.nb_collections % GC_STATS_RING_LEN];
+    unsigned int b;
+
+    s->pause_us = pause / 1000;
+    s->reclaimed = used_before > after->used ? used_before - after->used : 0;
+    s->live = after->used;
+    s->frag = after->free ? 100 - (after->max_free * MICROPY_BYTES_PER_GC_BLOCK * 100) / after->free : 0;
+
+    for (b = 0; b < GC_STATS_NB_BUCKETS - 1; ++b) {
+        if (s->pause_us < (GC_STATS_BUCKET_US << b)) {
+            break;
+        }
+    }
+    ++gc_stats.hist[b];
+    gc_stats.pause_total_us += s->pause_us;
+    if (s->pause_us > gc_stats.pause_max_us) {
+        gc_stats.pause_max_us = s->pause_us;
+    }
+    ++gc_stats.nb_collections;
+}
+
+void gc_stats_dump(void) {
+    unsigned int i, n;
+
+    printk("gc: %u collections, pause total %llu us, max %u us\n",
+           gc_stats.nb_collections, (unsigned long long)gc_stats.pause_total_us,
+           gc_stats.pause_max_us);
+    for (i = 0; i < GC_STATS_NB_BUCKETS; ++i) {
+        if (i < GC_STATS_NB_BUCKETS - 1) {
+            printk("gc: pause < %6u us: %u\n", GC_STATS_BUCKET_US << i, gc_stats.hist[i]);
+        } else {
+            printk("gc: pause >= %5u us: %u\n", GC_STATS_BUCKET_US << (i - 1), gc_stats.hist[i]);
+        }
+    }
+    n = gc_stats.nb_collections < GC_STATS_RING_LEN ? gc_stats.nb_collections : GC_STATS_RING_LEN;
+    for (i = gc_stats.nb_collections - n; i < gc_stats.nb_collections; ++i) {
+        struct gc_stats_sample *s = &gc_stats.ring[i % GC_STATS_RING_LEN];
+        printk("gc: #%u pause=%uus reclaimed=%u live=%u frag=%u%%\n",
+               i, s->pause_us, s->reclaimed, s->live, s->frag);
+    }
+}
+#endif
+
+// heap usage counters, see gc_alloc_counted()
+STATIC size_t gc_live_after_collect;
+STATIC size_t gc_alloc_since_collect;
+STATIC void gc_count_reset(const gc_info_t *info);
+
 void gc_collect(void) {
     //gc_dump_info();
 
+    #if MICROPY_GC_STATS
+    size_t used_before = gc_live_after_collect + gc_alloc_since_collect;
+    s_time_t start = NOW();
+    #endif
+
     gc_collect_start();
     regs_t regs;
     gc_helper_get_regs(regs);
-    // GC stack (and regs because we captured them)
+    // GC stack (and regs because we captured them). In stackless mode
+    // the frames of running Python functions are heap objects chained
+    // through code_state->prev; the innermost one is referenced from
+    // the C stack or a callee-saved register, both scanned here.
     void **regs_ptr = (void**)(void*)&regs;
     gc_collect_root(regs_ptr, ((uintptr_t)MP_STATE_VM(stack_top) - (uintptr_t)&regs) / sizeof(uintptr_t));
     #if MICROPY_EMIT_NATIVE
@@ -152,8 +219,63 @@ void gc_collect(void) {
     #endif
     gc_collect_end();
 
+    // the only walk of the allocation table, counted in the pause
+    gc_info_t info;
+    gc_info(&info);
+    #if MICROPY_GC_STATS
+    gc_stats_record(used_before, &info, NOW() - start);
+    #endif
+    gc_count_reset(&info);
+
     //printf("-----\n");
     //gc_dump_info();
 }
 
+// Idle-time collection: blocking waits (sleeps, socket polling) call
+// gc_collect_idle(), which runs a full collection once more than
+// gc_idle_percent of the heap is in use. Collections then mostly happen
+// while nothing is being served instead of on an allocation in the
+// middle of a request; they are not incremental, so a single one takes
+// as long as any other. gc_idle_percent = 0 leaves collection to
+// allocation failures only, which gives the fewest collections
+// (throughput) but the longest pauses on the request path.
+mp_uint_t gc_idle_percent = MICROPY_GC_IDLE_PERCENT;
+
+// Heap usage is estimated as what was live after the last collection
+// plus what was allocated since, so that gc_collect_idle() does not
+// walk the allocation table. py/malloc.c is built with gc_alloc
+// renamed to gc_alloc_counted (or to allocprof_gc_alloc, which calls
+// it), see the Makefile. Frees are not subtracted.
+STATIC size_t gc_heap_total;
+
+void *gc_alloc_counted(size_t n_bytes, bool has_finaliser) {
+    gc_alloc_since_collect += n_bytes;
+    return gc_alloc(n_bytes, has_finaliser);
+}
+
+STATIC void gc_count_reset(const gc_info_t *info) {
+    gc_heap_total = info->total;
+    gc_live_after_collect = info->used;
+    gc_alloc_since_collect = 0;
+}
+
+void gc_collect_idle(void) {
+    if (gc_idle_percent == 0) {
+        return;
+    }
+    if (gc_heap_total == 0) {
+        // no collection yet (or a restored snapshot)
+        gc_info_t info;
+        gc_info(&info);
+        gc_count_reset(&info);
+    }
+
+    // when most of the heap is live, collecting again is only worth it
+    // after another sixteenth of the heap has been allocated
+    if ((gc_live_after_collect + gc_alloc_since_collect) * 100 >= gc_heap_total * gc_idle_percent &&
+        gc_alloc_since_collect >= gc_heap_total / 16) {
+        gc_collect();
+    }
+}
+
 #endif //MICROPY_ENABLE_GC
@@ -0,0 +1,253 @@
+/*
+ * Minipython, a Xen-based Unikernel.
+ *
+ * Authors:  Felipe Huici <felipe.huici@neclab.eu>
+ *           Simon Kuenzer <simon.kuenzer@neclab.eu>
+ *
+ *
+ * Copyright (c) 2013-2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "minipython.h"
+
+#if MICROPY_IMPORT_STAT_CACHE
+
+#include <strings.h>
+#include "py/objlist.h"
+
+/* Import stat cache
+ *
+ * Every import probes each sys.path entry for a package directory and
+ * a .py file, and each probe is a FatFs directory walk. Results are
+ * remembered here, both positive and negative, so repeated imports are
+ * answered from memory.
+ *
+ * Before the first lookup, the sys.path directories are indexed: all
+ * of their entries are inserted and the directory is flagged as
+ * complete. A path missing from the table whose parent directory is
+ * complete does not exist, so misses below indexed directories need no
+ * probe either.
+ *
+ * Entries are tagged with a generation; bumping it drops all of them at
+ * once and has the directories indexed again on the next lookup. This
+ * happens on every FatFs call that may change the namespace (mount,
+ * file creation, removal, renaming, mkdir, chdir; see fatfs_port.c),
+ * except within the .mpy cache directory, which is never imported from.
+ * Entries are never evicted: when the table is full, new results are
+ * simply not cached, which keeps the completeness of indexed
+ * directories valid.
+ */
+
+#define ISC_PROBE_MAX   16
+#define ISC_INDEX_DEPTH 4
+#define ISC_PATH_MAX    256
+
+#define ISC_COMPLETE    0x80 /* flag: all entries of this dir are in the table */
+
+struct isc_entry {
+  uint32_t hash;
+  uint32_t gen;
+  uint8_t  stat; /* mp_import_stat_t | ISC_COMPLETE */
+  char    *path;
+};
+
+STATIC struct isc_entry isc_table[MICROPY_IMPORT_STAT_CACHE_SIZE];
+STATIC uint32_t isc_gen = 1;
+STATIC bool isc_index_pending = true;
+
+/* FatFs names are case-insensitive, and so is the cache */
+STATIC uint32_t isc_hash(const char *path, size_t len)
+{
+  uint32_t h = 2166136261u;
+
+  while (len--)
+    h = (h ^ (uint8_t) tolower((unsigned char) *path++)) * 16777619u;
+  return h;
+}
+
+STATIC struct isc_entry *isc_find(const char *path, size_t len)
+{
+  uint32_t h = isc_hash(path, len);
+  unsigned int i, slot;
+
+  for (i = 0; i < ISC_PROBE_MAX; ++i) {
+    slot = (h + i) % MICROPY_IMPORT_STAT_CACHE_SIZE;
+    if (isc_table[slot].gen != isc_gen)
+      return NULL; /* free slot: not in the table */
+    if (isc_table[slot].hash == h &&
+        strncasecmp(isc_table[slot].path, path, len) == 0 &&
+        isc_table[slot].path[len] == '\0')
+      return &isc_table[slot];
+  }
+  return NULL;
+}
+
+/* Returns false when the table has no room for path */
+STATIC bool isc_insert(const char *path, uint8_t stat)
+{
+  size_t len = strlen(path);
+  uint32_t h = isc_hash(path, len);
+  struct isc_entry *e;
+  unsigned int i;
+
+  for (i = 0; i < ISC_PROBE_MAX; ++i) {
+    e = &isc_table[(h + i) % MICROPY_IMPORT_STAT_CACHE_SIZE];
+    if (e->gen == isc_gen) {
+      if (e->hash == h && strcasecmp(e->path, path) == 0) {
+        e->stat = stat;
+        return true;
+      }
+      continue;
+    }
+    free(e->path);
+    e->path = malloc(len + 1);
+    if (!e->path)
+      return false;
+    memcpy(e->path, path, len + 1);
+    e->hash = h;
+    e->stat = stat;
+    e->gen = isc_gen;
+    return true;
+  }
+  return false;
+}
+
+bool import_stat_cache_lookup(const char *path, mp_import_stat_t *stat)
+{
+  struct isc_entry *e;
+  const char *sep;
+
+  if (isc_index_pending) {
+    isc_index_pending = false;
+    import_stat_cache_index();
+  }
+
+  e = isc_find(path, strlen(path));
+  if (e) {
+    *stat = (mp_import_stat_t) (e->stat & ~ISC_COMPLETE);
+    return true;
+  }
+
+  /* not in the table: check if the parent directory was indexed */
+  sep = strrchr(path, '/');
+  e = isc_find(path, sep ? (size_t) (sep - path) : 0);
+  if (e && (e->stat & ISC_COMPLETE)) {
+    *stat = MP_IMPORT_STAT_NO_EXIST;
+    return true;
+  }
+  return false;
+}
+
+void import_stat_cache_insert(const char *path, mp_import_stat_t stat)
+{
+  isc_insert(path, (uint8_t) stat);
+}
+
+void import_stat_cache_invalidate(void)
+{
+  ++isc_gen;
+  isc_index_pending = true;
+}
+
+/* Inserts all entries of dir (recursing depth levels into subdirectories)
+ * and flags dir as complete when all of them fit into the table. path
+ * is a buffer of size ISC_PATH_MAX holding dir. */
+STATIC bool isc_index_dir(char *path, size_t len, int depth)
+{
+  FILINFO fno;
+  DIR dp;
+  bool complete = true;
+  size_t n;
+  char *fn;
+#if _USE_LFN
+  char lfn[_MAX_LFN + 1];
+  fno.lfname = lfn;
+  fno.lfsize = sizeof(lfn);
+#endif
+
+  if (f_opendir(&dp, len ? path : "/") != FR_OK)
+    return false;
+
+  for (;;) {
+    if (f_readdir(&dp, &fno) != FR_OK || fno.fname[0] == '\0')
+      break;
+#if _USE_LFN
+    fn = *fno.lfname ? fno.lfname : fno.fname;
+#else
+    fn = fno.fname;
+#endif
+    if (fn[0] == '.' && (fn[1] == '\0' || (fn[1] == '.' && fn[2] == '\0')))
+      continue;
+
+    n = strlen(fn);
+    if (len + n + 2 > ISC_PATH_MAX) {
+      complete = false;
+      continue;
+    }
+    if (len)
+      path[len] = '/';
+    memcpy(path + len + (len ? 1 : 0), fn, n + 1);
+
+    if (fno.fattrib & AM_DIR) {
+      if (!isc_insert(path, MP_IMPORT_STAT_DIR))
+        complete = false;
+      else if (depth > 0)
+        isc_index_dir(path, len + n + (len ? 1 : 0), depth - 1);
+    } else {
+      if (!isc_insert(path, MP_IMPORT_STAT_FILE))
+        complete = false;
+    }
+    path[len] = '\0';
+  }
+  f_closedir(&dp);
+
+  return complete && isc_insert(path, MP_IMPORT_STAT_DIR | ISC_COMPLETE);
+}
+
+void import_stat_cache_index(void)
+{
+  char path[ISC_PATH_MAX];
+  mp_obj_t *items;
+  mp_uint_t nb_items, i, len;
+  const char *dir;
+
+  mp_obj_list_get(mp_sys_path, &nb_items, &items);
+  for (i = 0; i < nb_items; ++i) {
+    dir = mp_obj_str_get_data(items[i], &len);
+    if (len >= ISC_PATH_MAX)
+      continue;
+    memcpy(path, dir, len);
+    path[len] = '\0';
+    /* the root is only indexed one level deep: it holds the data of
+     * the application, not just its modules */
+    isc_index_dir(path, len, len ? ISC_INDEX_DEPTH : 0);
+  }
+}
+
+#endif /* MICROPY_IMPORT_STAT_CACHE */
@@ -0,0 +1,169 @@
+/*
+ * Minipython, a Xen-based Unikernel.
+ *
+ * Authors:  Felipe Huici <felipe.huici@neclab.eu>
+ *           Simon Kuenzer <simon.kuenzer@neclab.eu>
+ *
+ *
+ * Copyright (c) 2013-2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "minipython.h"
+
+#if MICROPY_JOB_RUNNER
+
+#include <mini-os/time.h>
+#include "py/objlist.h"
+
+/* Job runner
+ *
+ * Runs every script listed in a manifest file one after another in the
+ * same interpreter, so that domain creation, boot, imported modules,
+ * the SHFS cache and the network stack are paid for once instead of
+ * per job. Each line of the manifest names a script followed by its
+ * arguments (separated by blanks); empty lines and lines starting with
+ * '#' are skipped.
+ *
+ * Before each job the globals of __main__ are cleared, sys.argv is set
+ * to the job's arguments and garbage is collected. sys.modules is kept,
+ * so modules imported by an earlier job are already warm.
+ */
+
+#define JOB_MAX_ARGS 16
+
+/* Reads the whole manifest into a nul-terminated buffer on the GC heap */
+STATIC char *job_manifest_read(const char *path, size_t *buf_len)
+{
+  char *buf;
+#if MICROPY_VFS_FAT
+  FIL fp;
+  UINT n;
+  size_t len;
+
+  if (f_open(&fp, path, FA_READ) != FR_OK)
+    return NULL;
+  len = f_size(&fp);
+  buf = m_new(char, len + 1);
+  if (f_read(&fp, buf, len, &n) != FR_OK || n != len) {
+    f_close(&fp);
+    m_del(char, buf, len + 1);
+    return NULL;
+  }
+  f_close(&fp);
+  buf[len] = '\0';
+  *buf_len = len + 1;
+#elif SHFS_ENABLE
+  SHFS_FD f;
+  uint64_t len;
+
+  f = shfs_fio_open(path);
+  if (!f)
+    return NULL;
+  shfs_fio_size(f, &len);
+  buf = m_new(char, len + 1);
+  if (shfs_fio_read(f, 0, buf, len) < 0) {
+    shfs_fio_close(f);
+    m_del(char, buf, len + 1);
+    return NULL;
+  }
+  shfs_fio_close(f);
+  buf[len] = '\0';
+  *buf_len = len + 1;
+#else
+  (void) path;
+  (void) buf_len;
+  buf = NULL;
+#endif
+  return buf;
+}
+
+/* Gives the next job a fresh __main__ while keeping sys.modules */
+STATIC void job_reset(int argc, char **argv)
+{
+  mp_obj_dict_t *dict_main = &MP_STATE_VM(dict_main);
+  int i;
+
+  mp_obj_dict_init(dict_main, 1);
+  mp_obj_dict_store(MP_OBJ_FROM_PTR(dict_main), MP_OBJ_NEW_QSTR(MP_QSTR___name__),
+                    MP_OBJ_NEW_QSTR(MP_QSTR___main__));
+  mp_locals_set(dict_main);
+  mp_globals_set(dict_main);
+
+  mp_obj_list_init(MP_OBJ_TO_PTR(mp_sys_argv), 0);
+  for (i = 0; i < argc; ++i)
+    mp_obj_list_append(mp_sys_argv, MP_OBJ_NEW_QSTR(qstr_from_str(argv[i])));
+  evloop_init(); /* drop tasks left over by the previous job */
+
+  gc_collect();
+}
+
+int run_jobs(const char *manifest)
+{
+  char *buf, *line, *next;
+  size_t buf_len;
+  char *argv[JOB_MAX_ARGS];
+  int argc, ret;
+  unsigned int nb_jobs = 0, nb_failed = 0;
+  s_time_t t;
+
+  buf = job_manifest_read(manifest, &buf_len);
+  if (!buf) {
+    printk("Could not read job manifest %s\n", manifest);
+    return -ENOENT;
+  }
+
+  for (line = buf; line; line = next) {
+    next = strchr(line, '\n');
+    if (next)
+      *next++ = '\0';
+
+    /* split line into script and arguments */
+    argc = 0;
+    for (char *p = strtok(line, " \t\r"); p && argc < JOB_MAX_ARGS;
+         p = strtok(NULL, " \t\r"))
+      argv[argc++] = p;
+    if (argc == 0 || argv[0][0] == '#')
+      continue;
+
+    job_reset(argc, argv);
+    t = NOW();
+    ret = do_file(argv[0]);
+    printk("job %s: exit %d (%lu us)\n", argv[0], ret,
+           (unsigned long) ((NOW() - t) / 1000));
+    ++nb_jobs;
+    if (ret != 0)
+      ++nb_failed;
+  }
+
+  m_del(char, buf, buf_len);
+  printk("Ran %u jobs, %u failed\n", nb_jobs, nb_failed);
+  return nb_failed ? -1 : 0;
+}
+
+#endif /* MICROPY_JOB_RUNNER */
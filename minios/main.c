@@ -37,7 +37,11 @@
 #include "minipython.h"
 
 void run_script() {
+#if MICROPY_JOB_RUNNER
+  run_jobs(MICROPY_JOB_MANIFEST);
+#else
   do_file("helloworld-infinite.py");
   //  do_str("print('hello world')");
+#endif
 }
 
@@ -47,7 +47,164 @@ STATIC uint emit_opt = MP_EMIT_OPT_NONE;
 #if MICROPY_ENABLE_GC
 // Heap size of GC heap (if enabled)
 // Make it larger on a 64 bit machine, because pointers are larger.
-long heap_size = 1024*1024 * (sizeof(mp_uint_t) / 4);
+#define HEAP_SIZE (1024*1024 * (sizeof(mp_uint_t) / 4))
+// Bounds for the size requested at boot (see heap_configure())
+#define HEAP_SIZE_MIN (64*1024)
+#ifndef HEAP_SIZE_MAX
+#define HEAP_SIZE_MAX (256*1024*1024)
+#endif
+// Hard limit for HEAP_SIZE_MAX: gc_stats counts bytes in 32 bits
+#define HEAP_SIZE_LIMIT (2048L*1024*1024)
+#if HEAP_SIZE_MAX > HEAP_SIZE_LIMIT
+#error HEAP_SIZE_MAX exceeds HEAP_SIZE_LIMIT
+#endif
+long heap_size = HEAP_SIZE;
+#if MICROPY_HEAP_SNAPSHOT
+// Snapshots hold raw pointers into the heap, so it has to be at the
+// same address on every boot of an image
+STATIC char heap_area[HEAP_SIZE] __attribute__((aligned(PAGE_SIZE)));
+#endif
+#endif
+
+#if MICROPY_ENABLE_GC
+#if !MICROPY_HEAP_SNAPSHOT
+/* Parses a decimal size with an optional K, M or G suffix, returns 0
+ * on error. Sizes above HEAP_SIZE_LIMIT are returned as the limit. */
+STATIC long heap_parse_size(const char *str)
+{
+  unsigned long size;
+  unsigned int shift = 0;
+  char *end;
+
+  if (!isdigit((unsigned char) str[0]))
+    return 0; /* strtoul() would accept signs and spaces */
+  errno = 0;
+  size = strtoul(str, &end, 10);
+  if (errno == ERANGE)
+    return HEAP_SIZE_LIMIT;
+
+  switch (*end) {
+  case 'g': case 'G': shift = 30; ++end; break;
+  case 'm': case 'M': shift = 20; ++end; break;
+  case 'k': case 'K': shift = 10; ++end; break;
+  default: break;
+  }
+  if (*end != '\0')
+    return 0;
+  if (size > ((unsigned long) HEAP_SIZE_LIMIT >> shift))
+    return HEAP_SIZE_LIMIT;
+  return (long) (size << shift);
+}
+
+STATIC void heap_xenstore_size(const char *path, long *size)
+{
+  char *err, *val;
+  long parsed;
+
+  err = xenbus_read(XBT_NIL, path, &val);
+  if (err) {
+    free(err); /* key is optional */
+    return;
+  }
+  parsed = heap_parse_size(val);
+  if (parsed > 0)
+    *size = parsed;
+  free(val);
+}
+#endif
+
+/* Parses the GC mode: "idle" collects at idle points once half of the
+ * heap is used, "throughput" only when an allocation fails, and a
+ * number sets the idle collection threshold in percent */
+STATIC bool heap_parse_gc_mode(const char *str)
+{
+  if (strcmp(str, "idle") == 0)
+    gc_idle_percent = MICROPY_GC_IDLE_PERCENT ? : 50;
+  else if (strcmp(str, "throughput") == 0)
+    gc_idle_percent = 0;
+  else {
+    unsigned long percent;
+    char *end;
+
+    if (!isdigit((unsigned char) str[0]))
+      return false;
+    percent = strtoul(str, &end, 10);
+    if (*end != '\0' || percent > 100)
+      return false;
+    gc_idle_percent = percent;
+  }
+  return true;
+}
+
+/* Picks the heap size and GC mode for this boot: xenstore keys
+ * data/minipython/heap_size and data/minipython/gc are read first,
+ * heap=<size> and gc=<mode> on the domain command line override them.
+ * Consumed options are removed from argv. The heap is a single region
+ * of that size for the lifetime of the domain. Snapshot builds have a
+ * fixed heap and only take the GC mode. */
+STATIC void heap_configure(int *argc, char **argv)
+{
+  char *err, *mode;
+#if !MICROPY_HEAP_SNAPSHOT
+  long val;
+#endif
+  int i, j;
+
+#if !MICROPY_HEAP_SNAPSHOT
+  heap_xenstore_size("data/minipython/heap_size", &heap_size);
+#endif
+  err = xenbus_read(XBT_NIL, "data/minipython/gc", &mode);
+  if (err) {
+    free(err);
+  } else {
+    heap_parse_gc_mode(mode);
+    free(mode);
+  }
+
+  for (i = 0, j = 0; i < *argc; ++i) {
+#if MICROPY_HEAP_SNAPSHOT
+    if (strncmp(argv[i], "heap=", 5) == 0) {
+      printk("Ignoring %s: the heap size is fixed in snapshot builds\n", argv[i]);
+      continue;
+    }
+#else
+    if (strncmp(argv[i], "heap=", 5) == 0 &&
+        (val = heap_parse_size(argv[i] + 5)) > 0) {
+      heap_size = val;
+      continue;
+    }
+#endif
+    if (strncmp(argv[i], "gc=", 3) == 0 && heap_parse_gc_mode(argv[i] + 3))
+      continue;
+    argv[j++] = argv[i];
+  }
+  *argc = j;
+
+#if !MICROPY_HEAP_SNAPSHOT
+  if (heap_size > HEAP_SIZE_MAX)
+    heap_size = HEAP_SIZE_MAX;
+  if (heap_size < HEAP_SIZE_MIN)
+    heap_size = HEAP_SIZE_MIN;
+#endif
+}
+
+#if !MICROPY_HEAP_SNAPSHOT
+/* Allocates the GC heap, halving the requested size until it fits into
+ * the memory of the domain */
+STATIC char *heap_alloc(void)
+{
+  char *heap;
+
+  while (!(heap = malloc(heap_size)) && heap_size > HEAP_SIZE_MIN) {
+    heap_size = (heap_size / 2) & ~(BYTES_PER_WORD - 1);
+    if (heap_size < HEAP_SIZE_MIN)
+      heap_size = HEAP_SIZE_MIN;
+  }
+  if (heap)
+    printk("GC heap: %ld KiB\n", heap_size >> 10);
+  return heap;
+}
+#endif
 #endif
 
 STATIC void stderr_print_strn(void *env, const char *str, size_t len) {
@@ -83,14 +240,34 @@ int handle_uncaught_exception(mp_obj_base_t *exc) {
 typedef struct _mp_lexer_file_buf_t {
 #if SHFS_ENABLE
   SHFS_FD f;
-#endif
+  struct shfs_cache_entry *cce;    /* chunk currently fed to the lexer */
+  struct shfs_cache_entry *ra_cce; /* next chunk, prefetched while lexing */
+  SHFS_AIO_TOKEN *ra_t;
+  chk_t fchk;                      /* file chunk index of cce */
+  const byte *buf;
+#else
   byte buf[20];
-  uint16_t len;
-  uint16_t pos;
+#endif
+  uint32_t len;
+  uint32_t pos;
   uint64_t fpos;
   uint64_t fsize;
 } mp_lexer_file_buf_t;
 
+// Runs a compiled module, unless we are only compiling
+STATIC void execute_module_fun(mp_obj_t module_fun) {
+    if (!compile_only) {
+        // execute it
+        mp_call_function_0(module_fun);
+        // check for pending exception
+        if (MP_STATE_VM(mp_pending_exception) != MP_OBJ_NULL) {
+            mp_obj_t obj = MP_STATE_VM(mp_pending_exception);
+            MP_STATE_VM(mp_pending_exception) = MP_OBJ_NULL;
+            nlr_raise(obj);
+        }
+    }
+}
+
 // Returns standard error codes: 0 for success, 1 for all other errors,
 // except if FORCED_EXIT bit is set then script raised SystemExit and the
 // value of the exit is in the lower 8 bits of the return value
@@ -116,16 +293,7 @@ int execute_from_lexer(mp_lexer_t *lex, mp_parse_input_kind_t input_kind, bool i
 
         mp_obj_t module_fun = mp_compile(&parse_tree, source_name, emit_opt, is_repl);
 
-        if (!compile_only) {
-            // execute it
-            mp_call_function_0(module_fun);
-            // check for pending exception
-            if (MP_STATE_VM(mp_pending_exception) != MP_OBJ_NULL) {
-                mp_obj_t obj = MP_STATE_VM(mp_pending_exception);
-                MP_STATE_VM(mp_pending_exception) = MP_OBJ_NULL;
-                nlr_raise(obj);
-            }
-        }
+        execute_module_fun(module_fun);
 
         mp_hal_set_interrupt_char(-1);
         nlr_pop();
@@ -138,37 +306,159 @@ int execute_from_lexer(mp_lexer_t *lex, mp_parse_input_kind_t input_kind, bool i
     }
 }
 
+#if MICROPY_MPY_CACHE
+// Same as execute_from_lexer, but takes the bytecode from the .mpy
+// cache when the file was compiled on an earlier boot
+int execute_from_mpycache(const char *file) {
+    mp_hal_set_interrupt_char(CHAR_CTRL_C);
+
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        #if MICROPY_PY___FILE__
+        mp_store_global(MP_QSTR___file__, MP_OBJ_NEW_QSTR(qstr_from_str(file)));
+        #endif
+
+        mp_obj_t module_fun = mpycache_load_file(file, emit_opt);
+
+        execute_module_fun(module_fun);
+
+        mp_hal_set_interrupt_char(-1);
+        nlr_pop();
+        return 0;
+
+    } else {
+        // uncaught exception
+        mp_hal_set_interrupt_char(-1);
+        return handle_uncaught_exception(nlr.ret_val);
+    }
+}
+#endif
+
 #if MICROPY_USE_READLINE == 1
 #include "lib/mp-readline/readline.h"
 #else
 #endif
 
 #if SHFS_ENABLE
-STATIC mp_uint_t shfs_file_buf_next_byte(mp_lexer_file_buf_t *fb) {
-  uint64_t rlen;
+/* Blkfront readiness source of the event loop (see evloop.c) */
+STATIC void shfs_evloop_poll(void) {
+  shfs_poll_blkdevs();
+}
+
+/* Requests file chunk fchk through the SHFS cache. Returns 0 when the
+ * chunk is already loaded, 1 when an AIO request is in flight (*t is
+ * set) and a negative errno on failure. With wait set, -EAGAIN is
+ * retried until the cache can take the request. */
+STATIC int shfs_file_buf_aread(mp_lexer_file_buf_t *fb, chk_t fchk, struct shfs_cache_entry **cce, SHFS_AIO_TOKEN **t, bool wait) {
   int ret;
 
+  for (;;) {
+    ret = shfs_fio_cache_aread(fb->f, fchk, NULL, NULL, NULL, cce, t);
+    if (ret != -EAGAIN || !wait)
+      return ret;
+    schedule();
+    shfs_poll_blkdevs();
+  }
+}
+
+/* Waits for a pending chunk read and drops the entry if I/O failed */
+STATIC int shfs_file_buf_complete(struct shfs_cache_entry *cce, SHFS_AIO_TOKEN *t) {
+  int ret = 0;
+
+  if (t) {
+    shfs_aio_wait(t);
+    ret = shfs_aio_finalize(t);
+  } else if (unlikely(cce->invalid)) {
+    ret = -EIO;
+  }
+  if (ret < 0)
+    shfs_cache_release(cce);
+  return ret;
+}
+
+/* Starts reading the chunk following the current one, so that the
+ * block device works while the parser consumes the current chunk.
+ * Prefetching is best-effort: if the cache is busy, the next refill
+ * falls back to a synchronous read. */
+STATIC void shfs_file_buf_prefetch(mp_lexer_file_buf_t *fb) {
+  chk_t next = fb->fchk + 1;
+
+  fb->ra_cce = NULL;
+  fb->ra_t = NULL;
+  if (!shfs_is_fchk_in_bound(fb->f, next))
+    return;
+  if (shfs_file_buf_aread(fb, next, &fb->ra_cce, &fb->ra_t, false) < 0) {
+    fb->ra_cce = NULL;
+    fb->ra_t = NULL;
+  }
+}
+
+/* Pins the chunk holding file offset fb->fpos and points fb->buf at
+ * the readable bytes of it. Returns 0 on success, negative on error. */
+STATIC int shfs_file_buf_fill(mp_lexer_file_buf_t *fb) {
+  struct shfs_cache_entry *cce;
+  SHFS_AIO_TOKEN *t;
+  chk_t fchk;
+  uint64_t off;
+  int ret;
+
+  fchk = shfs_volchk_foff(fb->f, fb->fpos) - fb->f->hentry->f_attr.chunk;
+  off = shfs_volchkoff_foff(fb->f, fb->fpos);
+
+  if (fb->ra_cce && fchk == fb->fchk + 1) {
+    /* chunk was prefetched */
+    cce = fb->ra_cce;
+    t = fb->ra_t;
+    fb->ra_cce = NULL;
+    fb->ra_t = NULL;
+  } else {
+    if (fb->ra_cce) {
+      shfs_cache_release_ioabort(fb->ra_cce, fb->ra_t);
+      fb->ra_cce = NULL;
+      fb->ra_t = NULL;
+    }
+    ret = shfs_file_buf_aread(fb, fchk, &cce, &t, true);
+    if (ret < 0)
+      return ret;
+  }
+  ret = shfs_file_buf_complete(cce, t);
+  if (ret < 0)
+    return ret;
+
+  if (fb->cce)
+    shfs_cache_release(fb->cce);
+  fb->cce = cce;
+  fb->fchk = fchk;
+  fb->buf = (const byte *) cce->buffer + off;
+  fb->len = min(shfs_vol.chunksize - off, fb->fsize - fb->fpos);
+  fb->pos = 0;
+  fb->fpos += fb->len;
+
+  shfs_file_buf_prefetch(fb);
+  return 0;
+}
+
+STATIC mp_uint_t shfs_file_buf_next_byte(mp_lexer_file_buf_t *fb) {
   if (fb->pos >= fb->len) {
-    rlen = sizeof(fb->buf) + fb->fpos > fb->fsize ? fb->fsize - fb->fpos : sizeof(fb->buf);
-    if (rlen == 0) return MP_LEXER_EOF;
-    
-    ret = shfs_fio_read(fb->f, fb->fpos, &fb->buf, rlen);
-    fb->len = rlen;
-    fb->pos = 0;
-    fb->fpos += rlen;
+    if (fb->fpos >= fb->fsize)
+      return MP_LEXER_EOF;
+    if (shfs_file_buf_fill(fb) < 0)
+      return MP_LEXER_EOF;
   }
-  return fb->buf[fb->pos++];  
+  return fb->buf[fb->pos++];
 }
 
 STATIC void shfs_file_buf_close(mp_lexer_file_buf_t *fb) {
+  if (fb->ra_cce)
+    shfs_cache_release_ioabort(fb->ra_cce, fb->ra_t);
+  if (fb->cce)
+    shfs_cache_release(fb->cce);
   shfs_fio_close(fb->f);
   m_del_obj(mp_lexer_file_buf_t, fb);
 }
 
 mp_lexer_t *mp_lexer_new_from_file(const char *filename) {
-  uint64_t rlen;
-  int ret = 0;
-    
+  int ret;
   mp_lexer_file_buf_t *fb = m_new_obj_maybe(mp_lexer_file_buf_t);
 
   if (fb == NULL)  return NULL;
@@ -176,17 +466,27 @@ mp_lexer_t *mp_lexer_new_from_file(const char *filename) {
   fb->f = shfs_fio_open(filename);
   if (!fb->f) {
     printk("%s: Could not open: %s\n", filename, strerror(errno));
+    m_del_obj(mp_lexer_file_buf_t, fb);
     return NULL;
   }
 
   shfs_fio_size(fb->f, &fb->fsize);
-  rlen = sizeof(fb->buf) > fb->fsize ? fb->fsize : sizeof(fb->buf);
-  ret = shfs_fio_read(fb->f, 0, &fb->buf, rlen);
-  
-  fb->len = rlen;
-  fb->fpos = rlen;
+  fb->cce = NULL;
+  fb->ra_cce = NULL;
+  fb->ra_t = NULL;
+  fb->fchk = 0;
+  fb->buf = NULL;
+  fb->len = 0;
   fb->pos = 0;
-  
+  fb->fpos = 0;
+
+  ret = fb->fsize > 0 ? shfs_file_buf_fill(fb) : 0;
+  if (ret < 0) {
+    printk("%s: Could not read: %s\n", filename, strerror(-ret));
+    shfs_file_buf_close(fb);
+    return NULL;
+  }
+
   return mp_lexer_new(qstr_from_str(filename), fb, (mp_lexer_stream_next_byte_t)shfs_file_buf_next_byte, (mp_lexer_stream_close_t)shfs_file_buf_close);
 }
 #endif
@@ -204,9 +504,164 @@ int do_str(const char *str) {
     return execute_from_lexer(lex, MP_PARSE_FILE_INPUT, false);
 }
 
-int do_file(const char *file) {
+#if MICROPY_TIERING
+// Scripts that are run more than tier_threshold times (e.g., by the
+// job runner) are recompiled with tier_emit_opt; the resulting module
+// function replaces the bytecode for later runs, as long as the size
+// and modification time of the script stay the same. A threshold < 0
+// disables promotion. Promotion is per script, not per hot function:
+// the whole module, including code that ran only once, is recompiled.
+// Native code bypasses the VM hooks, hence the VM profiler, the Python
+// frames of the allocation profiler and Ctrl-C between bytecodes. The
+// lwIP timers and pending exceptions are still serviced whenever it
+// sleeps or blocks on a socket, as those wait through the event loop.
+int tier_threshold = MICROPY_TIER_THRESHOLD;
+uint tier_emit_opt = MP_EMIT_OPT_NATIVE_PYTHON;
+
+void tier_reset(void) {
+  MP_STATE_PORT(tier_dict) = mp_obj_new_dict(0);
+}
+
+// Stores the size and modification time of file in stamp; returns false
+// if the file cannot be stat'ed (it is then never promoted)
+STATIC bool tier_stat(const char *file, mp_obj_t *stamp) {
+#if MICROPY_VFS_FAT
+  FILINFO fno;
+#if _USE_LFN
+  fno.lfname = NULL;
+  fno.lfsize = 0;
+#endif
+  if (f_stat(file, &fno) != FR_OK) {
+    return false;
+  }
+  stamp[0] = mp_obj_new_int_from_uint(fno.fsize);
+  stamp[1] = MP_OBJ_NEW_SMALL_INT(((mp_int_t)fno.fdate << 16) | fno.ftime);
+  return true;
+#elif SHFS_ENABLE
+  // SHFS volumes are read-only: the size is enough
+  uint64_t fsize;
+  SHFS_FD f = shfs_fio_open(file);
+  if (!f) {
+    return false;
+  }
+  shfs_fio_size(f, &fsize);
+  shfs_fio_close(f);
+  stamp[0] = mp_obj_new_int_from_uint(fsize);
+  stamp[1] = MP_OBJ_NEW_SMALL_INT(0);
+  return true;
+#else
+  (void)file;
+  (void)stamp;
+  return false;
+#endif
+}
+
+// Counts a run of file and returns its promoted module function, or
+// MP_OBJ_NULL if file is to be run from bytecode. Entries are tuples
+// (size, mtime, state), where state is the number of runs so far, the
+// promoted module function or None if the tier-up emitter rejected the
+// script; a changed size or mtime restarts counting.
+STATIC mp_obj_t tier_lookup(const char *file) {
+  mp_obj_t entry[3];
+
+  if (tier_threshold < 0 || !tier_stat(file, entry)) {
+    return MP_OBJ_NULL;
+  }
+  if (MP_STATE_PORT(tier_dict) == MP_OBJ_NULL) {
+    tier_reset();
+  }
+
+  mp_obj_t key = MP_OBJ_NEW_QSTR(qstr_from_str(file));
+  mp_map_elem_t *elem = mp_map_lookup(mp_obj_dict_get_map(MP_STATE_PORT(tier_dict)),
+                                      key, MP_MAP_LOOKUP_ADD_IF_NOT_FOUND);
+  entry[2] = MP_OBJ_NEW_SMALL_INT(0);
+  if (elem->value != MP_OBJ_NULL) {
+    mp_obj_t *old;
+    mp_obj_tuple_get(elem->value, NULL, &old);
+    if (mp_obj_equal(old[0], entry[0]) && mp_obj_equal(old[1], entry[1])) {
+      entry[2] = old[2];
+    }
+  }
+  if (!MP_OBJ_IS_SMALL_INT(entry[2])) {
+    return entry[2] == mp_const_none ? MP_OBJ_NULL : entry[2];
+  }
+
+  mp_int_t runs = MP_OBJ_SMALL_INT_VALUE(entry[2]) + 1;
+  entry[2] = MP_OBJ_NEW_SMALL_INT(runs);
+  elem->value = mp_obj_new_tuple(3, entry);
+  if (runs <= tier_threshold) {
+    return MP_OBJ_NULL;
+  }
+
+  // hot: recompile it, the native emitters raise on unsupported code
+  mp_obj_t module_fun = MP_OBJ_NULL;
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    mp_lexer_t *lex = mp_lexer_new_from_file(file);
+    if (lex == NULL) {
+      nlr_raise(mp_obj_new_exception(&mp_type_MemoryError));
+    }
+    qstr source_name = lex->source_name;
+    mp_parse_tree_t parse_tree = mp_parse(lex, MP_PARSE_FILE_INPUT);
+    module_fun = mp_compile(&parse_tree, source_name, tier_emit_opt, false);
+    nlr_pop();
+    printk("Promoted %s to native code after %d runs\n", file, (int)runs - 1);
+  } else {
+    mp_obj_print_exception(&mp_stderr_print, MP_OBJ_FROM_PTR(nlr.ret_val));
+  }
+  // the dict may have been resized while compiling
+  entry[2] = module_fun != MP_OBJ_NULL ? module_fun : mp_const_none;
+  mp_obj_dict_store(MP_STATE_PORT(tier_dict), key, mp_obj_new_tuple(3, entry));
+  return module_fun;
+}
+
+STATIC int execute_tiered(const char *file, mp_obj_t module_fun) {
+    mp_hal_set_interrupt_char(CHAR_CTRL_C);
+
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        #if MICROPY_PY___FILE__
+        mp_store_global(MP_QSTR___file__, MP_OBJ_NEW_QSTR(qstr_from_str(file)));
+        #endif
+
+        execute_module_fun(module_fun);
+
+        mp_hal_set_interrupt_char(-1);
+        nlr_pop();
+        return 0;
+
+    } else {
+        // uncaught exception
+        mp_hal_set_interrupt_char(-1);
+        return handle_uncaught_exception(nlr.ret_val);
+    }
+}
+#endif
+
+STATIC int do_file_exec(const char *file) {
+#if MICROPY_TIERING
+  mp_obj_t module_fun = tier_lookup(file);
+  if (module_fun != MP_OBJ_NULL) {
+    return execute_tiered(file, module_fun);
+  }
+#endif
+#if MICROPY_MPY_CACHE
+  return execute_from_mpycache(file);
+#else
   mp_lexer_t *lex = mp_lexer_new_from_file(file);
   return execute_from_lexer(lex, MP_PARSE_FILE_INPUT, false);
+#endif
+}
+
+// Script run by do_file(), profilers attribute their samples to it
+qstr current_script = MP_QSTR_;
+
+int do_file(const char *file) {
+  qstr prev_script = current_script;
+  current_script = qstr_from_str(file);
+  int ret = do_file_exec(file);
+  current_script = prev_script;
+  return ret;
 }
 
 void print_banner() {
@@ -227,8 +682,19 @@ void print_banner() {
   printk("\n");
 }
 
-uint mp_import_stat(const char *path) {
-  #if MICROPY_VFS_FAT
+// Set while the script runs and has not imported from the filesystem
+// yet; its first import ends the boot profile
+STATIC bool bootprof_first_import = false;
+
+STATIC mp_import_stat_t import_stat(const char *path) {
+  #if MICROPY_VFS_FAT && MICROPY_IMPORT_STAT_CACHE
+  mp_import_stat_t stat;
+  if (!import_stat_cache_lookup(path, &stat)) {
+    stat = fat_vfs_import_stat(path);
+    import_stat_cache_insert(path, stat);
+  }
+  return stat;
+  #elif MICROPY_VFS_FAT
   return fat_vfs_import_stat(path);
   #else
   struct stat st;
@@ -243,6 +709,32 @@ uint mp_import_stat(const char *path) {
   #endif
 }
 
+uint mp_import_stat(const char *path) {
+  if (bootprof_first_import) {
+    bootprof_first_import = false;
+    bootprof_mark("first_import");
+    bootprof_close();
+  }
+  #if MICROPY_MPY_CACHE
+  // modules with a source are loaded as .mpy, through the bytecode
+  // cache (see mpycache.c). builtinimport.c looks for the __init__.py
+  // of packages only as such, so those are compiled from source.
+  size_t len = strlen(path);
+  const char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  if (len > 3 && strcmp(path + len - 3, ".py") == 0 && strcmp(base, "__init__.py") != 0) {
+    mp_import_stat_t stat = import_stat(path);
+    return stat == MP_IMPORT_STAT_FILE ? MP_IMPORT_STAT_NO_EXIST : stat;
+  }
+  char src[MICROPY_ALLOC_PATH_MAX];
+  if (mpycache_source_path(path, src, sizeof(src)) &&
+      import_stat(src) == MP_IMPORT_STAT_FILE) {
+    return MP_IMPORT_STAT_FILE;
+  }
+  #endif
+  return import_stat(path);
+}
+
 void nlr_jump_fail(void *val) {
   printf("FATAL: uncaught NLR %p\n", val);
   exit(1);
@@ -275,21 +767,59 @@ void pythonpath_append(char *path) {
 int main(int argc, char **argv) {
     int i;
 
+    bootprof_mark("main");
+
     /* minipython banner */
     print_banner();  
+    bootprof_mark("banner");
+
+#if MICROPY_ENABLE_GC
+    /* boot options: heap size and GC mode */
+    heap_configure(&argc, argv);
+#endif
+
+#if MICROPY_HEAP_SNAPSHOT
+    /* restore heap and interpreter state of a warmed-up VM */
+    char *heap = heap_area;
+    bool restored = (snapshot_restore(heap, heap_size) == 0);
+    if (restored) {
+      printk("Restored interpreter snapshot\n");
+    }
+    bootprof_mark("snapshot_restore");
+#endif
 
     /* init stack */
     mp_stack_ctrl_init();
+    /* in stackless mode only calls through C (builtins, generators,
+     * special methods) still recurse on the C stack */
     mp_stack_set_limit(40000 * (BYTES_PER_WORD / 4));
 
+#if MICROPY_HEAP_SNAPSHOT
+    if (!restored) {
+      gc_init(heap, heap + heap_size);
+      bootprof_mark("gc_init");
+      mp_init();
+      bootprof_mark("mp_init");
+    }
+#else
     /* init garbage collector */
 #if MICROPY_ENABLE_GC
-    char *heap = malloc(heap_size);
+    char *heap = heap_alloc();
+    if (!heap) {
+      printk("Could not allocate GC heap of %ld bytes\n", heap_size);
+      return -1;
+    }
     gc_init(heap, heap + heap_size);
+    bootprof_mark("gc_init");
 #endif
 
     /* init micropython */
     mp_init();
+    bootprof_mark("mp_init");
+#endif
+
+    /* empty run queue, no timers and waiters */
+    evloop_init();
 
     /* append dirs to python path (NO leading slashes
      * please, and use ":" as the separator) */
@@ -309,6 +839,8 @@ int main(int argc, char **argv) {
     init_shfs();
     ret = mount_shfs(&id, 1);   
     if (ret < 0) return 0;
+    evloop_add_source(shfs_evloop_poll, true);
+    bootprof_mark("mount_shfs");
 #endif
 #if MICROPY_VFS_FAT
     fs_user_mount_t fs_user_mount;
@@ -323,16 +855,31 @@ int main(int argc, char **argv) {
       printk("Error while mounting drive: %d\n", res);
       return -1;
     }
+    bootprof_mark("f_mount");
+
+#endif
 
+#if MICROPY_HEAP_SNAPSHOT
+    /* first boot: warm up the VM and save it for the next boots */
+    if (!restored && do_file(MICROPY_SNAPSHOT_WARMUP) == 0) {
+      int ret = snapshot_save(heap, heap_size);
+      if (ret < 0) {
+        printk("Could not save interpreter snapshot: %d\n", ret);
+      }
+      bootprof_mark("snapshot_save");
+    }
 #endif
 
+    bootprof_mark("run_script");
+    bootprof_first_import = true;
     run_script();
+    bootprof_close();
 
     /* deinit micro-python */
     mp_deinit();
 
     /* free the heap */
-#if MICROPY_ENABLE_GC && !defined(NDEBUG)
+#if MICROPY_ENABLE_GC && !defined(NDEBUG) && !MICROPY_HEAP_SNAPSHOT
     // We don't really need to free memory since we are about to exit the
     // process, but doing so helps to find memory leaks.
     free(heap);
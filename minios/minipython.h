@@ -47,6 +47,7 @@
 #include <errno.h>
 
 #include "console.h"
+#include "xenbus.h"
 #include "py/mpstate.h"
 #include "py/nlr.h"
 #include "py/compile.h"
@@ -59,6 +60,8 @@
 #include "extmod/misc.h"
 #include "genhdr/mpversion.h"
 #include "input.h"
+#include "bootprof.h"
+#include "evloop.h"
 #if SHFS_ENABLE
 #include "shfs/shfs.h"
 #include "shfs/shfs_fio.h"
@@ -73,6 +76,12 @@ extern mp_import_stat_t fat_vfs_import_stat(const char *path);
 int handle_uncaught_exception(mp_obj_base_t *exc);
 int execute_from_lexer(mp_lexer_t *lex, mp_parse_input_kind_t input_kind, bool is_repl);
 
+#if MICROPY_MPY_CACHE
+int execute_from_mpycache(const char *file);
+mp_obj_t mpycache_load_file(const char *filename, uint emit_opt);
+bool mpycache_source_path(const char *path, char *src, size_t srclen);
+#endif
+
 #if SHFS_ENABLE
 STATIC mp_uint_t shfs_file_buf_next_byte(mp_lexer_file_buf_t *fb);
 STATIC void shfs_file_buf_close(mp_lexer_file_buf_t *fb);
@@ -84,6 +93,84 @@ mp_lexer_t *mp_lexer_new_from_file(const char *filename);
 mp_obj_t vfs_proxy_call(qstr method_name, mp_uint_t n_args, const mp_obj_t *args);
 #endif
 
+#if MICROPY_IMPORT_STAT_CACHE
+bool import_stat_cache_lookup(const char *path, mp_import_stat_t *stat);
+void import_stat_cache_insert(const char *path, mp_import_stat_t stat);
+void import_stat_cache_invalidate(void);
+void import_stat_cache_index(void);
+#endif
+
+#if MICROPY_ENABLE_GC
+extern mp_uint_t gc_idle_percent;
+void *gc_alloc_counted(size_t n_bytes, bool has_finaliser);
+#endif
+
+#if MICROPY_GC_STATS
+/* Pause histogram bucket i counts pauses shorter than
+ * GC_STATS_BUCKET_US << i; the last bucket counts all longer ones */
+#define GC_STATS_NB_BUCKETS 12
+#define GC_STATS_BUCKET_US  64
+#define GC_STATS_RING_LEN   32
+
+struct gc_stats_sample {
+  uint32_t pause_us;  /* including the walk that measures live and frag */
+  uint32_t reclaimed; /* bytes, estimated from the allocation counter */
+  uint32_t live;      /* bytes */
+  uint8_t  frag;      /* percent of free memory outside the largest free block */
+};
+
+struct gc_stats {
+  uint32_t nb_collections;
+  uint64_t pause_total_us;
+  uint32_t pause_max_us;
+  uint32_t hist[GC_STATS_NB_BUCKETS];
+  struct gc_stats_sample ring[GC_STATS_RING_LEN]; /* last collections */
+};
+
+extern struct gc_stats gc_stats;
+void gc_stats_dump(void);
+#endif
+
+#if MICROPY_ALLOC_PROFILE
+extern size_t allocprof_rate;
+void *allocprof_gc_alloc(size_t n_bytes, bool has_finaliser);
+void allocprof_start(size_t rate);
+unsigned int allocprof_dump(const mp_print_t *print);
+#endif
+
+#if MICROPY_EMIT_NATIVE
+bool mp_unix_exec_in_use(void);
+#endif
+
+#if MICROPY_HEAP_SNAPSHOT
+#include <mini-os/os.h>
+int snapshot_restore(char *heap, size_t heap_len);
+int snapshot_save(char *heap, size_t heap_len);
+bool lwip_in_use(void);
+#endif
+
+mp_obj_t bootprof_dict(void);
+#if MICROPY_JOB_RUNNER
+int run_jobs(const char *manifest);
+#endif
+
+#if MICROPY_TIERING
+extern int tier_threshold;
+extern uint tier_emit_opt;
+void tier_reset(void);
+#endif
+
+#if MICROPY_VM_PROFILE || MICROPY_ALLOC_PROFILE
+struct _mp_code_state;
+mp_uint_t vm_source_line(const struct _mp_code_state *code_state);
+#endif
+
+#if MICROPY_VM_PROFILE
+void vmprof_start(unsigned int hz);
+unsigned int vmprof_dump(const mp_print_t *print);
+#endif
+
+extern qstr current_script;
 int do_str(const char *str);
 int do_file(const char *file);
 void print_banner();
@@ -58,6 +58,7 @@ PY_O_BASENAME = \
 	parsenumbase.o \
 	parsenum.o \
 	emitglue.o \
+	persistentcode.o \
 	runtime.o \
 	runtime_utils.o \
 	nativeglue.o \
@@ -187,6 +188,8 @@ APP_MODS_SRC_C = $(addprefix mods/,\
 	modtime.c                  \
         modos.c                    \
         modlwip.c                  \
+        modminipython.c            \
+        moduevloop.c               \
         )
 
 # prepend the build destination prefix to the py object files
@@ -48,6 +48,7 @@
 #include <mini-os/lwip-net.h>
 #include "modlwip.h"
 #include "xenbus.h"
+#include "evloop.h"
 
 #if 0 // print debugging info
 #define DEBUG_printf DEBUG_printf
@@ -88,6 +89,54 @@ static int lwip_ether_objs_count = 0;
 
 STATIC int lwip_find_ip(const char *ip, char *found_ip);
 STATIC int lwip_find_next_noip(int offset);
+
+// Netfront readiness source of the event loop (see evloop.c)
+STATIC void lwip_poll_netifs(void) {
+    int i;
+
+    for (i = 0; i < lwip_ether_objs_count; i++)
+        netfrontif_poll(&lwip_ether_objs[i].netif);
+}
+
+// lwIP timer service of the event loop: runs the TCP (retransmission,
+// delayed ACK), ARP and DNS timeouts and asks to be called again when
+// the next one is due. A TCP timer armed in between, when the first
+// connection opens, is thus late by at most TCP_TMR_INTERVAL.
+STATIC mp_uint_t lwip_tick(void) {
+    sys_check_timeouts();
+    u32_t ms = sys_timeouts_sleeptime();
+    return ms < TCP_TMR_INTERVAL ? ms : TCP_TMR_INTERVAL;
+}
+
+// Whether an interface or a socket was set up: both keep state outside of
+// the GC heap (netfront rings, pcbs), so a heap snapshot cannot hold them
+bool lwip_in_use(void) {
+    struct tcp_pcb *pcb;
+    struct udp_pcb *upcb;
+
+    if (lwip_ether_objs_count > 0 || tcp_listen_pcbs.pcbs != NULL) {
+        return true;
+    }
+    // sockets are the callback argument of their pcbs; the DNS resolver
+    // has a pcb of its own, without argument
+    for (pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
+        if (pcb->callback_arg != NULL) {
+            return true;
+        }
+    }
+    for (pcb = tcp_bound_pcbs; pcb != NULL; pcb = pcb->next) {
+        if (pcb->callback_arg != NULL) {
+            return true;
+        }
+    }
+    for (upcb = udp_pcbs; upcb != NULL; upcb = upcb->next) {
+        if (upcb->recv_arg != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
 STATIC lwip_ether_obj_t *lwip_addif(const ip4_addr_t *ip, const ip4_addr_t *mask, const ip4_addr_t *gw);
 
 STATIC lwip_ether_obj_t *lwip_addif(const ip4_addr_t *ip,
@@ -154,8 +203,12 @@ STATIC lwip_ether_obj_t *lwip_addif(const ip4_addr_t *ip,
               &obj->nfi,
               netfrontif_init,
               ethernet_input);
-    if (lwip_ether_objs_count == 0)
+    if (lwip_ether_objs_count == 0) {
         netif_set_default(&obj->netif);
+        // netfrontif does not wake the event loop on received packets
+        evloop_add_source(lwip_poll_netifs, false);
+        evloop_add_ticker(lwip_tick);
+    }
     netif_set_up(&obj->netif);
 
     /* Get ready for next device */
@@ -191,9 +244,10 @@ STATIC mp_obj_t lwip_ether_make_new(const mp_obj_type_t *type_in,
     return lwip_addif(&ip, &mask, &gw);
 }
 
+// Polls through the event loop, which polls all interfaces and runs
+// the lwIP timers, but never reenters lwIP from a socket callback
 STATIC mp_obj_t lwip_ether_poll(mp_obj_t e) {
-  lwip_ether_obj_t *obj = (lwip_ether_obj_t*)e;
-  netfrontif_poll(&obj->netif);
+  evloop_poll();
   return mp_const_none;
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_1(lwip_ether_poll_obj, lwip_ether_poll);
@@ -374,11 +428,171 @@ static const int error_lookup_table[] = {
 #define MOD_NETWORK_SOCK_DGRAM (2)
 #define MOD_NETWORK_SOCK_RAW (3)
 
-static inline void poll_sockets(void) {
-    int i;
+// Same values as in lwip/sockets.h
+#define MOD_NETWORK_SO_RCVBUF (0x1002)
+#define MOD_NETWORK_SO_ERROR (0x1007)
 
-    for (i = 0; i < lwip_ether_objs_count; i++)
-        netfrontif_poll(&lwip_ether_objs[i].netif);
+// Blocking socket calls wait through the event loop: netfront and all
+// other sources are polled, so that disk I/O and idle collection also
+// progress, and the application thread sleeps in between. The
+// conditions below are what the respective lwIP callbacks change.
+
+STATIC bool lwip_udp_readable(void *arg) {
+    lwip_socket_obj_t *socket = arg;
+    return socket->udp_q_len != 0;
+}
+
+STATIC bool lwip_tcp_readable(void *arg) {
+    lwip_socket_obj_t *socket = arg;
+    return socket->state != STATE_CONNECTED || socket->recv_q_len != 0;
+}
+
+STATIC bool lwip_tcp_writable(void *arg) {
+    lwip_socket_obj_t *socket = arg;
+    // Avoid sending too small packets, so wait until at least 16 bytes available
+    return socket->state < STATE_CONNECTED || tcp_sndbuf(socket->pcb.tcp) >= 16;
+}
+
+STATIC bool lwip_tcp_connect_done(void *arg) {
+    lwip_socket_obj_t *socket = arg;
+    return socket->state != STATE_CONNECTING;
+}
+
+/*******************************************************************************/
+// Zero-copy TCP send. Buffers of immutable objects are passed to lwIP by
+// reference and the objects are pinned until the tcp_sent callback reports
+// that all of their bytes were acknowledged. Sockets holding pins are kept
+// in a list hanging off a root pointer, so that the GC sees the pins even
+// after the socket was closed and dropped by the application.
+
+// Whether obj can be sent without copying its len bytes
+STATIC bool lwip_can_pin(mp_obj_t obj, mp_uint_t len) {
+    if (len < MICROPY_PY_LWIP_ZEROCOPY_MIN) {
+        return false;
+    }
+    if (MP_OBJ_IS_TYPE(obj, &mp_type_bytes)) {
+        return true;
+    }
+    #if MICROPY_PY_BUILTINS_MEMORYVIEW
+    mp_buffer_info_t bufinfo;
+    if (MP_OBJ_IS_TYPE(obj, &mp_type_memoryview)) {
+        return !mp_get_buffer(obj, &bufinfo, MP_BUFFER_WRITE);
+    }
+    #endif
+    return false;
+}
+
+// Makes room for one more pin. May raise, so it has to be called before
+// the buffer is handed to lwIP.
+STATIC void lwip_pins_reserve(lwip_socket_obj_t *socket) {
+    if (socket->pins_len < socket->pins_alloc) {
+        return;
+    }
+    uint16_t n = socket->pins_alloc ? socket->pins_alloc * 2 : 8;
+    lwip_pin_t *pins = m_new(lwip_pin_t, n);
+    for (uint16_t i = 0; i < socket->pins_len; i++) {
+        pins[i] = socket->pins[(socket->pins_head + i) % socket->pins_alloc];
+    }
+    m_del(lwip_pin_t, socket->pins, socket->pins_alloc);
+    socket->pins = pins;
+    socket->pins_alloc = n;
+    socket->pins_head = 0;
+}
+
+// Pins obj until everything written to the socket so far is acknowledged
+STATIC void lwip_pin(lwip_socket_obj_t *socket, mp_obj_t obj) {
+    if (socket->pins_len == 0) {
+        socket->pinned_prev = NULL;
+        socket->pinned_next = MP_STATE_PORT(lwip_pinned);
+        if (socket->pinned_next != NULL) {
+            socket->pinned_next->pinned_prev = socket;
+        }
+        MP_STATE_PORT(lwip_pinned) = socket;
+    }
+    lwip_pin_t *pin = &socket->pins[(socket->pins_head + socket->pins_len) % socket->pins_alloc];
+    pin->obj = obj;
+    pin->end = socket->sent_bytes;
+    socket->pins_len++;
+}
+
+// Releases the pins whose bytes were acknowledged, or all of them
+STATIC void lwip_unpin(lwip_socket_obj_t *socket, bool all) {
+    while (socket->pins_len > 0
+           && (all || (int32_t)(socket->acked_bytes - socket->pins[socket->pins_head].end) >= 0)) {
+        socket->pins[socket->pins_head].obj = MP_OBJ_NULL;
+        socket->pins_head = (socket->pins_head + 1) % socket->pins_alloc;
+        socket->pins_len--;
+        if (socket->pins_len == 0) {
+            if (socket->pinned_prev != NULL) {
+                socket->pinned_prev->pinned_next = socket->pinned_next;
+            } else {
+                MP_STATE_PORT(lwip_pinned) = socket->pinned_next;
+            }
+            if (socket->pinned_next != NULL) {
+                socket->pinned_next->pinned_prev = socket->pinned_prev;
+            }
+            socket->pinned_prev = socket->pinned_next = NULL;
+        }
+    }
+}
+
+/*******************************************************************************/
+// Interest sets (lwip.epoll). A set keeps its registered sockets in an
+// array and a list of those that may be ready. Callbacks add a socket to
+// that list whenever its readiness may have changed, so that waiting only
+// has to look at the sockets on the list rather than at the whole set.
+
+// Notes that the readiness of socket may have changed
+STATIC void lwip_epoll_notify(lwip_socket_obj_t *socket) {
+    lwip_epoll_obj_t *ep = socket->ep;
+
+    if (ep == NULL || socket->ep_ready) {
+        return;
+    }
+    socket->ep_ready = true;
+    socket->ep_prev = ep->ready_tail;
+    socket->ep_next = NULL;
+    if (ep->ready_tail != NULL) {
+        ep->ready_tail->ep_next = socket;
+    } else {
+        ep->ready_head = socket;
+    }
+    ep->ready_tail = socket;
+    ep->ready_len++;
+}
+
+// Takes socket off the ready list of its set
+STATIC void lwip_epoll_unready(lwip_socket_obj_t *socket) {
+    lwip_epoll_obj_t *ep = socket->ep;
+
+    if (!socket->ep_ready) {
+        return;
+    }
+    if (socket->ep_prev != NULL) {
+        socket->ep_prev->ep_next = socket->ep_next;
+    } else {
+        ep->ready_head = socket->ep_next;
+    }
+    if (socket->ep_next != NULL) {
+        socket->ep_next->ep_prev = socket->ep_prev;
+    } else {
+        ep->ready_tail = socket->ep_prev;
+    }
+    socket->ep_prev = socket->ep_next = NULL;
+    socket->ep_ready = false;
+    ep->ready_len--;
+}
+
+// Removes socket from its set
+STATIC void lwip_epoll_del(lwip_socket_obj_t *socket) {
+    lwip_epoll_obj_t *ep = socket->ep;
+
+    lwip_epoll_unready(socket);
+    lwip_socket_obj_t *last = ep->socks[--ep->socks_len];
+    ep->socks[socket->ep_index] = last;
+    last->ep_index = socket->ep_index;
+    ep->socks[ep->socks_len] = NULL;
+    socket->ep = NULL;
 }
 
 /*******************************************************************************/
@@ -390,19 +604,37 @@ static inline void exec_user_callback(lwip_socket_obj_t *socket) {
     }
 }
 
-// Callback for incoming UDP packets. We simply stash the packet and the source address,
+// Callback for incoming UDP packets. We simply queue the packet and the source address,
 // in case we need it for recvfrom.
 STATIC void _lwip_udp_incoming(void *arg, struct udp_pcb *upcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
     lwip_socket_obj_t *socket = (lwip_socket_obj_t*)arg;
 
-    if (socket->incoming.pbuf != NULL) {
+    if (socket->udp_q_len == MICROPY_PY_LWIP_UDP_RECV_QUEUE
+        || socket->udp_q_bytes + p->tot_len > socket->udp_rcvbuf) {
         // That's why they call it "unreliable". No room in the inn, drop the packet.
+        socket->udp_drops++;
         pbuf_free(p);
-    } else {
-        socket->incoming.pbuf = p;
-        socket->peer_port = (mp_uint_t)port;
-        memcpy(&socket->peer, addr, sizeof(socket->peer));
+        return;
     }
+
+    lwip_dgram_t *d = &socket->udp_q[(socket->udp_q_head + socket->udp_q_len) % MICROPY_PY_LWIP_UDP_RECV_QUEUE];
+    d->p = p;
+    d->port = port;
+    memcpy(d->ip, addr, sizeof(d->ip));
+    socket->udp_q_len++;
+    socket->udp_q_bytes += p->tot_len;
+    lwip_epoll_notify(socket);
+}
+
+// Frees the oldest datagram in the receive queue
+STATIC void lwip_udp_q_drop(lwip_socket_obj_t *socket) {
+    lwip_dgram_t *d = &socket->udp_q[socket->udp_q_head];
+
+    socket->udp_q_bytes -= d->p->tot_len;
+    pbuf_free(d->p);
+    d->p = NULL;
+    socket->udp_q_head = (socket->udp_q_head + 1) % MICROPY_PY_LWIP_UDP_RECV_QUEUE;
+    socket->udp_q_len--;
 }
 
 // Callback for general tcp errors.
@@ -413,6 +645,25 @@ STATIC void _lwip_tcp_error(void *arg, err_t err) {
     socket->state = err;
     // If we got here, the lwIP stack either has deallocated or will deallocate the pcb.
     socket->pcb.tcp = NULL;
+    // ...together with the data it still referred to
+    lwip_unpin(socket, true);
+    lwip_epoll_notify(socket);
+}
+
+// Callback for acknowledged data, releases objects sent without copying.
+STATIC err_t _lwip_tcp_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    lwip_socket_obj_t *socket = (lwip_socket_obj_t*)arg;
+
+    socket->acked_bytes += len;
+    lwip_unpin(socket, false);
+    lwip_epoll_notify(socket);
+    if (socket->pcb.tcp == NULL && socket->pins_len == 0) {
+        // Socket was closed and lwIP is done with our objects
+        tcp_arg(tpcb, NULL);
+        tcp_sent(tpcb, NULL);
+        tcp_err(tpcb, NULL);
+    }
+    return ERR_OK;
 }
 
 // Callback for tcp connection requests. Error code err is unused. (See tcp.h)
@@ -420,6 +671,7 @@ STATIC err_t _lwip_tcp_connected(void *arg, struct tcp_pcb *tpcb, err_t err) {
     lwip_socket_obj_t *socket = (lwip_socket_obj_t*)arg;
 
     socket->state = STATE_CONNECTED;
+    lwip_epoll_notify(socket);
     return ERR_OK;
 }
 
@@ -432,24 +684,60 @@ STATIC err_t _lwip_tcp_recv_unaccepted(void *arg, struct tcp_pcb *pcb, struct pb
     return ERR_BUF;
 }
 
+// Error callback of connections in the accept queue. lwIP frees the
+// pcb, so forget about it; arg points to its slot in the queue.
+STATIC void _lwip_tcp_unaccepted_error(void *arg, err_t err) {
+    *(struct tcp_pcb**)arg = NULL;
+}
+
 // Callback for incoming tcp connections.
 STATIC err_t _lwip_tcp_accept(void *arg, struct tcp_pcb *newpcb, err_t err) {
     lwip_socket_obj_t *socket = (lwip_socket_obj_t*)arg;
     tcp_recv(newpcb, _lwip_tcp_recv_unaccepted);
 
-    if (socket->incoming.connection != NULL) {
-        DEBUG_printf("_lwip_tcp_accept: Tried to queue >1 pcb waiting for accept\n");
-        // We need to handle this better. This single-level structure makes the
-        // backlog setting kind of pointless. FIXME
+    if (socket->accept_q_len == socket->accept_q_alloc) {
+        // Backlog is full; lwIP resets the connection when we fail here,
+        // so a flood of handshakes cannot pile up pcbs.
+        DEBUG_printf("_lwip_tcp_accept: backlog full\n");
         return ERR_BUF;
-    } else {
-        socket->incoming.connection = newpcb;
-        exec_user_callback(socket);
-        return ERR_OK;
     }
+    struct tcp_pcb **slot = &socket->accept_q[(socket->accept_q_head + socket->accept_q_len) % socket->accept_q_alloc];
+    *slot = newpcb;
+    socket->accept_q_len++;
+    tcp_arg(newpcb, (void*)slot);
+    tcp_err(newpcb, _lwip_tcp_unaccepted_error);
+    lwip_epoll_notify(socket);
+    exec_user_callback(socket);
+    return ERR_OK;
+}
+
+// Returns the oldest connection waiting for accept(), or NULL; drops
+// connections that were reset while waiting
+STATIC struct tcp_pcb *lwip_accept_q_peek(lwip_socket_obj_t *socket) {
+    while (socket->accept_q_len > 0 && socket->accept_q[socket->accept_q_head] == NULL) {
+        socket->accept_q_head = (socket->accept_q_head + 1) % socket->accept_q_alloc;
+        socket->accept_q_len--;
+    }
+    return socket->accept_q_len > 0 ? socket->accept_q[socket->accept_q_head] : NULL;
+}
+
+// Same as lwip_accept_q_peek(), but also removes the connection
+STATIC struct tcp_pcb *lwip_accept_q_pop(lwip_socket_obj_t *socket) {
+    struct tcp_pcb *pcb = lwip_accept_q_peek(socket);
+
+    if (pcb != NULL) {
+        socket->accept_q[socket->accept_q_head] = NULL;
+        socket->accept_q_head = (socket->accept_q_head + 1) % socket->accept_q_alloc;
+        socket->accept_q_len--;
+    }
+    return pcb;
 }
 
-// Callback for inbound tcp packets.
+// Callback for inbound tcp packets. Segments are queued until read;
+// lwIP does not deliver more than the window we advertised, since the
+// window is only opened again by tcp_recved() in lwip_tcp_receive().
+// Once the ring is full, segments are chained to its last entry, so
+// only the window limits how much is queued.
 STATIC err_t _lwip_tcp_recv(void *arg, struct tcp_pcb *tcpb, struct pbuf *p, err_t err) {
     lwip_socket_obj_t *socket = (lwip_socket_obj_t*)arg;
 
@@ -457,14 +745,31 @@ STATIC err_t _lwip_tcp_recv(void *arg, struct tcp_pcb *tcpb, struct pbuf *p, err
         // Other side has closed connection.
         DEBUG_printf("_lwip_tcp_recv[%p]: other side closed connection\n", socket);
         socket->state = STATE_PEER_CLOSED;
+        lwip_epoll_notify(socket);
         exec_user_callback(socket);
         return ERR_OK;
-    } else if (socket->incoming.pbuf != NULL) {
+    } else if (socket->recv_q_bytes + p->tot_len > TCP_WND) {
         // No room in the inn, let LWIP know it's still responsible for delivery later
         return ERR_BUF;
     }
-    socket->incoming.pbuf = p;
+    if (socket->recv_q_len == MICROPY_PY_LWIP_TCP_RECV_QUEUE) {
+        struct pbuf *tail = socket->recv_q[(socket->recv_q_head + socket->recv_q_len - 1) % MICROPY_PY_LWIP_TCP_RECV_QUEUE];
+        if ((u32_t)tail->tot_len + p->tot_len > 0xffff) {
+            // tot_len is 16 bits (only with a scaled window)
+            return ERR_BUF;
+        }
+        if (socket->recv_q_len == 1 && socket->leftover_count != 0) {
+            // the tail is being read, keep its read offset
+            socket->leftover_count += p->tot_len;
+        }
+        pbuf_cat(tail, p);
+    } else {
+        socket->recv_q[(socket->recv_q_head + socket->recv_q_len) % MICROPY_PY_LWIP_TCP_RECV_QUEUE] = p;
+        socket->recv_q_len++;
+    }
+    socket->recv_q_bytes += p->tot_len;
 
+    lwip_epoll_notify(socket);
     exec_user_callback(socket);
 
     return ERR_OK;
@@ -481,15 +786,30 @@ STATIC mp_uint_t lwip_udp_send(lwip_socket_obj_t *socket, const byte *buf, mp_ui
         len = 0xffff;
     }
 
-    // FIXME: maybe PBUF_ROM?
-    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    // Larger payloads are only referenced: udp_sendto() chains them to a
+    // header pbuf, and they are copied by the time it returns (netfront
+    // copies into its persistently granted tx buffers, ARP copies what
+    // it has to queue). Without persistent grants, netfront grants the
+    // pbuf memory itself until the backend is done, so everything is
+    // copied. Small ones are copied behind the headers, which saves an
+    // allocation.
+    struct pbuf *p;
+    if (MICROPY_PY_LWIP_UDP_ZEROCOPY && len >= MICROPY_PY_LWIP_ZEROCOPY_MIN) {
+        p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_REF);
+        if (p != NULL) {
+            p->payload = (void*)buf;
+        }
+    } else {
+        p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+        if (p != NULL) {
+            memcpy(p->payload, buf, len);
+        }
+    }
     if (p == NULL) {
         *_errno = ENOMEM;
         return -1;
     }
 
-    memcpy(p->payload, buf, len);
-
     err_t err;
     if (ip == NULL) {
         err = udp_send(socket->pcb.udp, p);
@@ -512,36 +832,25 @@ STATIC mp_uint_t lwip_udp_send(lwip_socket_obj_t *socket, const byte *buf, mp_ui
     return len;
 }
 
-// Helper function for recv/recvfrom to handle UDP packets
+// Helper function for recv/recvfrom to handle UDP packets. Takes the oldest
+// queued datagram; what does not fit into buf is discarded.
 STATIC mp_uint_t lwip_udp_receive(lwip_socket_obj_t *socket, byte *buf, mp_uint_t len, byte *ip, mp_uint_t *port, int *_errno) {
 
-    if (socket->incoming.pbuf == NULL) {
-        if (socket->timeout != -1) {
-            for (mp_uint_t retries = socket->timeout / 100; retries--;) {
-                mp_hal_delay_ms(100);
-                if (socket->incoming.pbuf != NULL) break;
-            }
-            if (socket->incoming.pbuf == NULL) {
-                *_errno = ETIMEDOUT;
-                return -1;
-            }
-        } else {
-            while (socket->incoming.pbuf == NULL) {
-                poll_sockets();
-            }
+    if (socket->udp_q_len == 0) {
+        if (!evloop_wait(lwip_udp_readable, socket, socket->timeout)) {
+            *_errno = socket->timeout == 0 ? EAGAIN : ETIMEDOUT;
+            return -1;
         }
     }
 
+    lwip_dgram_t *d = &socket->udp_q[socket->udp_q_head];
     if (ip != NULL) {
-        memcpy(ip, &socket->peer, sizeof(socket->peer));
-        *port = socket->peer_port;
+        memcpy(ip, d->ip, sizeof(d->ip));
+        *port = d->port;
     }
 
-    struct pbuf *p = socket->incoming.pbuf;
-
-    u16_t result = pbuf_copy_partial(p, buf, ((p->tot_len > len) ? len : p->tot_len), 0);
-    pbuf_free(p);
-    socket->incoming.pbuf = NULL;
+    u16_t result = pbuf_copy_partial(d->p, buf, ((d->p->tot_len > len) ? len : d->p->tot_len), 0);
+    lwip_udp_q_drop(socket);
 
     return (mp_uint_t) result;
 }
@@ -555,8 +864,9 @@ STATIC mp_uint_t lwip_udp_receive(lwip_socket_obj_t *socket, byte *buf, mp_uint_
         assert(socket->pcb.tcp);
 
 
-// Helper function for send/sendto to handle TCP packets
-STATIC mp_uint_t lwip_tcp_send(lwip_socket_obj_t *socket, const byte *buf, mp_uint_t len, int *_errno) {
+// Helper function for send/sendto to handle TCP packets. If pin_obj is
+// given, buf belongs to it and is passed to lwIP without copying.
+STATIC mp_uint_t lwip_tcp_send(lwip_socket_obj_t *socket, const byte *buf, mp_uint_t len, mp_obj_t pin_obj, int *_errno) {
     // Check for any pending errors
     STREAM_ERROR_CHECK(socket);
 
@@ -569,34 +879,40 @@ STATIC mp_uint_t lwip_tcp_send(lwip_socket_obj_t *socket, const byte *buf, mp_ui
             return MP_STREAM_ERROR;
         }
 
-        mp_uint_t start = mp_hal_ticks_ms();
         // Assume that STATE_PEER_CLOSED may mean half-closed connection, where peer closed it
         // sending direction, but not receiving. Consequently, check for both STATE_CONNECTED
         // and STATE_PEER_CLOSED as normal conditions and still waiting for buffers to be sent.
         // If peer fully closed socket, we would have socket->state set to ERR_RST (connection
         // reset) by error callback.
-        // Avoid sending too small packets, so wait until at least 16 bytes available
-        while (socket->state >= STATE_CONNECTED && (available = tcp_sndbuf(socket->pcb.tcp)) < 16) {
-            if (socket->timeout != -1 && mp_hal_ticks_ms() - start > socket->timeout) {
-                *_errno = ETIMEDOUT;
-                return MP_STREAM_ERROR;
-            }
-            poll_sockets();
+        if (!evloop_wait(lwip_tcp_writable, socket, socket->timeout)) {
+            *_errno = ETIMEDOUT;
+            return MP_STREAM_ERROR;
         }
 
         // While we waited, something could happen
         STREAM_ERROR_CHECK(socket);
+        available = tcp_sndbuf(socket->pcb.tcp);
     }
 
     u16_t write_len = MIN(available, len);
 
-    err_t err = tcp_write(socket->pcb.tcp, buf, write_len, TCP_WRITE_FLAG_COPY);
+    u8_t apiflags = TCP_WRITE_FLAG_COPY;
+    if (pin_obj != MP_OBJ_NULL) {
+        lwip_pins_reserve(socket);
+        apiflags = 0;
+    }
+
+    err_t err = tcp_write(socket->pcb.tcp, buf, write_len, apiflags);
 
     if (err != ERR_OK) {
         *_errno = error_lookup_table[-err];
         return MP_STREAM_ERROR;
     }
 
+    socket->sent_bytes += write_len;
+    if (pin_obj != MP_OBJ_NULL) {
+        lwip_pin(socket, pin_obj);
+    }
     return write_len;
 }
 
@@ -605,7 +921,7 @@ STATIC mp_uint_t lwip_tcp_receive(lwip_socket_obj_t *socket, byte *buf, mp_uint_
     // Check for any pending errors
     STREAM_ERROR_CHECK(socket);
 
-    if (socket->incoming.pbuf == NULL) {
+    if (socket->recv_q_len == 0) {
 
         // Non-blocking socket
         if (socket->timeout == 0) {
@@ -616,17 +932,13 @@ STATIC mp_uint_t lwip_tcp_receive(lwip_socket_obj_t *socket, byte *buf, mp_uint_
             return -1;
         }
 
-        mp_uint_t start = mp_hal_ticks_ms();
-        while (socket->state == STATE_CONNECTED && socket->incoming.pbuf == NULL) {
-            if (socket->timeout != -1 && mp_hal_ticks_ms() - start > socket->timeout) {
-                *_errno = ETIMEDOUT;
-                return -1;
-            }
-            poll_sockets();
+        if (!evloop_wait(lwip_tcp_readable, socket, socket->timeout)) {
+            *_errno = ETIMEDOUT;
+            return -1;
         }
 
         if (socket->state == STATE_PEER_CLOSED) {
-            if (socket->incoming.pbuf == NULL) {
+            if (socket->recv_q_len == 0) {
                 // socket closed and no data left in buffer
                 return 0;
             }
@@ -639,24 +951,30 @@ STATIC mp_uint_t lwip_tcp_receive(lwip_socket_obj_t *socket, byte *buf, mp_uint_
 
     assert(socket->pcb.tcp != NULL);
 
-    struct pbuf *p = socket->incoming.pbuf;
+    // Copy across as many queued pbuf chains as fit into buf
+    mp_uint_t result = 0;
+    while (result < len && socket->recv_q_len > 0) {
+        struct pbuf *p = socket->recv_q[socket->recv_q_head];
 
-    if (socket->leftover_count == 0) {
-        socket->leftover_count = p->tot_len;
-    }
+        if (socket->leftover_count == 0) {
+            socket->leftover_count = p->tot_len;
+        }
 
-    u16_t result = pbuf_copy_partial(p, buf, ((socket->leftover_count >= len) ? len : socket->leftover_count), (p->tot_len - socket->leftover_count));
-    if (socket->leftover_count > len) {
-        // More left over...
-        socket->leftover_count -= len;
-    } else {
-        pbuf_free(p);
-        socket->incoming.pbuf = NULL;
-        socket->leftover_count = 0;
+        u16_t n = (socket->leftover_count >= len - result) ? len - result : socket->leftover_count;
+        n = pbuf_copy_partial(p, buf + result, n, (p->tot_len - socket->leftover_count));
+        socket->leftover_count -= n;
+        if (socket->leftover_count == 0) {
+            pbuf_free(p);
+            socket->recv_q[socket->recv_q_head] = NULL;
+            socket->recv_q_head = (socket->recv_q_head + 1) % MICROPY_PY_LWIP_TCP_RECV_QUEUE;
+            socket->recv_q_len--;
+        }
+        socket->recv_q_bytes -= n;
+        result += n;
+        tcp_recved(socket->pcb.tcp, n);
     }
 
-    tcp_recved(socket->pcb.tcp, result);
-    return (mp_uint_t) result;
+    return result;
 }
 
 /*******************************************************************************/
@@ -664,10 +982,86 @@ STATIC mp_uint_t lwip_tcp_receive(lwip_socket_obj_t *socket, byte *buf, mp_uint_
 
 STATIC const mp_obj_type_t lwip_socket_type;
 
+// Readiness of a socket for the event loop; errors and hang-ups are
+// always reported, like poll(2) does
+mp_uint_t lwip_socket_poll(mp_obj_t self_in, mp_uint_t flags) {
+    lwip_socket_obj_t *socket = self_in;
+    mp_uint_t ret = 0;
+
+    if (mp_obj_get_type(self_in) != &lwip_socket_type) {
+        nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EBADF)));
+    }
+    if (socket->state < 0 || socket->pcb.tcp == NULL) {
+        return EVLOOP_IO_ERR | EVLOOP_IO_HUP;
+    }
+
+    if (socket->type == MOD_NETWORK_SOCK_DGRAM) {
+        if ((flags & EVLOOP_IO_RD) && socket->udp_q_len > 0) {
+            ret |= EVLOOP_IO_RD;
+        }
+        if (flags & EVLOOP_IO_WR) {
+            ret |= EVLOOP_IO_WR;
+        }
+        return ret;
+    }
+
+    if (socket->pcb.tcp->state == LISTEN) {
+        if ((flags & EVLOOP_IO_RD) && lwip_accept_q_peek(socket) != NULL) {
+            ret |= EVLOOP_IO_RD;
+        }
+        return ret;
+    }
+    if ((flags & EVLOOP_IO_RD) && socket->recv_q_len > 0) {
+        ret |= EVLOOP_IO_RD;
+    }
+    if (socket->state == STATE_PEER_CLOSED) {
+        // reads return EOF right away
+        ret |= (flags & EVLOOP_IO_RD) | EVLOOP_IO_HUP;
+    }
+    if ((flags & EVLOOP_IO_WR) && socket->state >= STATE_CONNECTED
+        && tcp_sndbuf(socket->pcb.tcp) > 0) {
+        ret |= EVLOOP_IO_WR;
+    }
+    return ret;
+}
+
 void lwip_socket_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
     lwip_socket_obj_t *self = self_in;
-    mp_printf(print, "<socket state=%d timeout=%d incoming=%p remaining=%d>", self->state, self->timeout,
-        self->incoming.pbuf, self->leftover_count);
+    mp_printf(print, "<socket state=%d timeout=%d queued=%u remaining=%d dropped=%u>", self->state, self->timeout,
+        (unsigned int)(self->recv_q_bytes + self->udp_q_bytes), self->leftover_count, (unsigned int)self->udp_drops);
+}
+
+// Sets up empty receive and accept queues for a socket of socket->type
+STATIC void lwip_socket_init_queues(lwip_socket_obj_t *socket) {
+    socket->leftover_count = 0;
+    socket->recv_q_head = 0;
+    socket->recv_q_len = 0;
+    socket->recv_q_bytes = 0;
+    socket->accept_q = NULL;
+    socket->accept_q_alloc = 0;
+    socket->accept_q_head = 0;
+    socket->accept_q_len = 0;
+    socket->udp_q = NULL;
+    if (socket->type == MOD_NETWORK_SOCK_DGRAM) {
+        socket->udp_q = m_new0(lwip_dgram_t, MICROPY_PY_LWIP_UDP_RECV_QUEUE);
+    }
+    socket->udp_q_head = 0;
+    socket->udp_q_len = 0;
+    socket->udp_q_bytes = 0;
+    socket->udp_rcvbuf = MICROPY_PY_LWIP_UDP_RCVBUF;
+    socket->udp_drops = 0;
+    socket->pins = NULL;
+    socket->pins_alloc = 0;
+    socket->pins_head = 0;
+    socket->pins_len = 0;
+    socket->sent_bytes = 0;
+    socket->acked_bytes = 0;
+    socket->pinned_prev = NULL;
+    socket->pinned_next = NULL;
+    socket->ep = NULL;
+    socket->ep_ready = false;
+    socket->ep_prev = NULL;
+    socket->ep_next = NULL;
 }
 
 // FIXME: Only supports two arguments at present
@@ -678,6 +1072,7 @@ mp_obj_t lwip_socket_make_new(const mp_obj_type_t *type, mp_uint_t n_args,
     if (!LWIP_INIT) {
       lwip_init();
       LWIP_INIT = true;      
+      evloop_add_ticker(lwip_tick);
     }
     
     lwip_socket_obj_t *socket = m_new_obj_with_finaliser(lwip_socket_obj_t);
@@ -692,6 +1087,9 @@ mp_obj_t lwip_socket_make_new(const mp_obj_type_t *type, mp_uint_t n_args,
         }
     }
 
+    // allocate the queues first, a failing allocation must not leak a pcb
+    lwip_socket_init_queues(socket);
+
     switch (socket->type) {
         case MOD_NETWORK_SOCK_STREAM: socket->pcb.tcp = tcp_new(); break;
         case MOD_NETWORK_SOCK_DGRAM: socket->pcb.udp = udp_new(); break;
@@ -708,6 +1106,8 @@ mp_obj_t lwip_socket_make_new(const mp_obj_type_t *type, mp_uint_t n_args,
             tcp_arg(socket->pcb.tcp, (void*)socket);
             // Register our error callback.
             tcp_err(socket->pcb.tcp, _lwip_tcp_error);
+            // ...and the one releasing data sent without copying
+            tcp_sent(socket->pcb.tcp, _lwip_tcp_sent);
             break;
         }
         case MOD_NETWORK_SOCK_DGRAM: {
@@ -717,16 +1117,18 @@ mp_obj_t lwip_socket_make_new(const mp_obj_type_t *type, mp_uint_t n_args,
             break;
         }
     }
-    socket->incoming.pbuf = NULL;
     socket->timeout = -1;
     socket->state = STATE_NEW;
-    socket->leftover_count = 0;
     return socket;
 }
 
 mp_obj_t lwip_socket_close(mp_obj_t self_in) {
     lwip_socket_obj_t *socket = self_in;
-    bool socket_is_listener = false;
+
+    // Like epoll, forget about closed sockets
+    if (socket->ep != NULL) {
+        lwip_epoll_del(socket);
+    }
 
     if (socket->pcb.tcp == NULL) {
         return mp_const_none;
@@ -734,12 +1136,30 @@ mp_obj_t lwip_socket_close(mp_obj_t self_in) {
 
     switch (socket->type) {
         case MOD_NETWORK_SOCK_STREAM: {
-            if (socket->pcb.tcp->state == LISTEN) {
-                socket_is_listener = true;
+            struct tcp_pcb *pcb = socket->pcb.tcp;
+            if (pcb->state != LISTEN) {
+                // A connection that is not yet established, or that is reset
+                // because of unread or refused data, is purged by tcp_close()
+                // without calling the err callback (same test as lwIP's
+                // tcp_close_shutdown()). Otherwise lwIP keeps the pcb to send
+                // what is queued, and we stay its callback argument while it
+                // refers to pinned objects.
+                bool reset = (pcb->state == ESTABLISHED || pcb->state == CLOSE_WAIT)
+                    && (pcb->refused_data != NULL || pcb->rcv_wnd != TCP_WND_MAX(pcb)
+                        || socket->recv_q_bytes > 0);
+                if (pcb->state == SYN_SENT || reset) {
+                    lwip_unpin(socket, true);
+                }
+                tcp_recv(pcb, NULL);
+                if (socket->pins_len == 0) {
+                    tcp_arg(pcb, NULL);
+                    tcp_sent(pcb, NULL);
+                    tcp_err(pcb, NULL);
+                }
             }
-            if (tcp_close(socket->pcb.tcp) != ERR_OK) {
+            if (tcp_close(pcb) != ERR_OK) {
                 DEBUG_printf("lwip_close: had to call tcp_abort()\n");
-                tcp_abort(socket->pcb.tcp);
+                tcp_abort(pcb);
             }
             break;
         }
@@ -749,14 +1169,23 @@ mp_obj_t lwip_socket_close(mp_obj_t self_in) {
     
     socket->pcb.tcp = NULL;
     socket->state = _ERR_BADF;
-    if (socket->incoming.pbuf != NULL) {
-        if (!socket_is_listener) {
-            pbuf_free(socket->incoming.pbuf);
-        } else {
-            tcp_abort(socket->incoming.connection);
+    while (socket->udp_q_len > 0) {
+        lwip_udp_q_drop(socket);
+    }
+    if (socket->accept_q != NULL) {
+        struct tcp_pcb *pcb;
+        while ((pcb = lwip_accept_q_pop(socket)) != NULL) {
+            tcp_abort(pcb);
         }
-        socket->incoming.pbuf = NULL;
     }
+    while (socket->recv_q_len > 0) {
+        pbuf_free(socket->recv_q[socket->recv_q_head]);
+        socket->recv_q[socket->recv_q_head] = NULL;
+        socket->recv_q_head = (socket->recv_q_head + 1) % MICROPY_PY_LWIP_TCP_RECV_QUEUE;
+        socket->recv_q_len--;
+    }
+    socket->recv_q_bytes = 0;
+    socket->leftover_count = 0;
 
     return mp_const_none;
 }
@@ -998,6 +1427,17 @@ mp_obj_t lwip_socket_listen(mp_obj_t self_in, mp_obj_t backlog_in) {
         nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EOPNOTSUPP)));
     }
 
+    // The backlog sizes the accept queue; connections beyond it are reset
+    if (backlog < 1) {
+        backlog = 1;
+    } else if (backlog > MICROPY_PY_LWIP_LISTEN_BACKLOG_MAX) {
+        backlog = MICROPY_PY_LWIP_LISTEN_BACKLOG_MAX;
+    }
+    if (socket->accept_q == NULL) {
+        socket->accept_q = m_new0(struct tcp_pcb*, backlog);
+        socket->accept_q_alloc = backlog;
+    }
+
     struct tcp_pcb *new_pcb = tcp_listen_with_backlog(socket->pcb.tcp, (u8_t)backlog);
     if (new_pcb == NULL) {
         nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(ENOMEM)));
@@ -1009,57 +1449,55 @@ mp_obj_t lwip_socket_listen(mp_obj_t self_in, mp_obj_t backlog_in) {
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_2(lwip_socket_listen_obj, lwip_socket_listen);
 
-mp_obj_t lwip_socket_accept(mp_obj_t self_in) {
-    lwip_socket_obj_t *socket = self_in;
+STATIC bool lwip_acceptable(void *arg) {
+    return lwip_accept_q_peek(arg) != NULL;
+}
 
+// Checks that socket is listening and waits, according to its timeout,
+// until a connection is waiting in the accept queue
+
+STATIC void lwip_socket_accept_wait(lwip_socket_obj_t *socket) {
     if (socket->pcb.tcp == NULL) {
         nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EBADF)));
     }
     if (socket->type != MOD_NETWORK_SOCK_STREAM) {
         nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EOPNOTSUPP)));
     }
-    // I need to do this because "tcp_accepted", later, is a macro.
-    struct tcp_pcb *listener = socket->pcb.tcp;
-    if (listener->state != LISTEN) {
+    if (socket->pcb.tcp->state != LISTEN) {
         nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EINVAL)));
     }
 
-    // accept incoming connection
-    if (socket->incoming.connection == NULL) {
-        if (socket->timeout != -1) {
-            for (mp_uint_t retries = socket->timeout / 100; retries--;) {
-                mp_hal_delay_ms(100);
-                if (socket->incoming.connection != NULL) break;
-            }
-            if (socket->incoming.connection == NULL) {
-                nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(ETIMEDOUT)));
-            }
-        } else {
-            while (socket->incoming.connection == NULL) {
-	      poll_sockets();
-            }
-        }
+    if (lwip_accept_q_peek(socket) == NULL
+        && !evloop_wait(lwip_acceptable, socket, socket->timeout)) {
+        nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError,
+            MP_OBJ_NEW_SMALL_INT(socket->timeout == 0 ? EAGAIN : ETIMEDOUT)));
     }
+}
 
-    // create new socket object
+// Takes the oldest waiting connection off the accept queue; returns
+// (socket, address)
+STATIC mp_obj_t lwip_socket_accept_one(lwip_socket_obj_t *socket) {
+    // I need to do this because "tcp_accepted", later, is a macro.
+    struct tcp_pcb *listener = socket->pcb.tcp;
+
+    // create new socket object (before dequeuing, allocation may fail)
     lwip_socket_obj_t *socket2 = m_new_obj_with_finaliser(lwip_socket_obj_t);
     socket2->base.type = (mp_obj_t)&lwip_socket_type;
 
     // We get a new pcb handle...
-    socket2->pcb.tcp = socket->incoming.connection;
-    socket->incoming.connection = NULL;
+    socket2->pcb.tcp = lwip_accept_q_pop(socket);
 
     // ...and set up the new socket for it.
     socket2->domain = MOD_NETWORK_AF_INET;
     socket2->type = MOD_NETWORK_SOCK_STREAM;
-    socket2->incoming.pbuf = NULL;
     socket2->timeout = socket->timeout;
     socket2->state = STATE_CONNECTED;
-    socket2->leftover_count = 0;
+    lwip_socket_init_queues(socket2);
     socket2->callback = MP_OBJ_NULL;
     tcp_arg(socket2->pcb.tcp, (void*)socket2);
     tcp_err(socket2->pcb.tcp, _lwip_tcp_error);
     tcp_recv(socket2->pcb.tcp, _lwip_tcp_recv);
+    tcp_sent(socket2->pcb.tcp, _lwip_tcp_sent);
 
     tcp_accepted(listener);
 
@@ -1073,8 +1511,34 @@ mp_obj_t lwip_socket_accept(mp_obj_t self_in) {
 
     return client;
 }
+
+mp_obj_t lwip_socket_accept(mp_obj_t self_in) {
+    lwip_socket_obj_t *socket = self_in;
+
+    lwip_socket_accept_wait(socket);
+    return lwip_socket_accept_one(socket);
+}
 STATIC MP_DEFINE_CONST_FUN_OBJ_1(lwip_socket_accept_obj, lwip_socket_accept);
 
+// accept_many(n): waits like accept() for the first connection, then
+// takes up to n connections off the queue; returns a list of
+// (socket, address) tuples
+mp_obj_t lwip_socket_accept_many(mp_obj_t self_in, mp_obj_t n_in) {
+    lwip_socket_obj_t *socket = self_in;
+    mp_int_t n = mp_obj_get_int(n_in);
+    mp_obj_t list = mp_obj_new_list(0, NULL);
+
+    if (n <= 0) {
+        return list;
+    }
+    lwip_socket_accept_wait(socket);
+    while (n-- > 0 && lwip_accept_q_peek(socket) != NULL) {
+        mp_obj_list_append(list, lwip_socket_accept_one(socket));
+    }
+    return list;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(lwip_socket_accept_many_obj, lwip_socket_accept_many);
+
 mp_obj_t lwip_socket_connect(mp_obj_t self_in, mp_obj_t addr_in) {
     ip_addr_t dest;
     lwip_socket_obj_t *socket = self_in;
@@ -1127,18 +1591,9 @@ mp_obj_t lwip_socket_connect(mp_obj_t self_in, mp_obj_t addr_in) {
             socket->peer_port = (mp_uint_t)port;
             memcpy(socket->peer, &dest, sizeof(socket->peer));
             // And now we wait...
-            if (socket->timeout != -1) {
-                for (mp_uint_t retries = socket->timeout / 100; retries--;) {
-                    mp_hal_delay_ms(100);
-                    if (socket->state != STATE_CONNECTING) break;
-                }
-                if (socket->state == STATE_CONNECTING) {
-                    nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(ETIMEDOUT)));
-                }
-            } else {
-                while (socket->state == STATE_CONNECTING) {
-                    poll_sockets();
-                }
+            if (!evloop_wait(lwip_tcp_connect_done, socket, socket->timeout)) {
+                nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError,
+                    MP_OBJ_NEW_SMALL_INT(socket->timeout == 0 ? EINPROGRESS : ETIMEDOUT)));
             }
             if (socket->state == STATE_CONNECTED) {
                err = ERR_OK;
@@ -1180,7 +1635,8 @@ mp_obj_t lwip_socket_send(mp_obj_t self_in, mp_obj_t buf_in) {
     mp_uint_t ret = 0;
     switch (socket->type) {
         case MOD_NETWORK_SOCK_STREAM: {
-            ret = lwip_tcp_send(socket, bufinfo.buf, bufinfo.len, &_errno);
+            mp_obj_t pin_obj = lwip_can_pin(buf_in, bufinfo.len) ? buf_in : MP_OBJ_NULL;
+            ret = lwip_tcp_send(socket, bufinfo.buf, bufinfo.len, pin_obj, &_errno);
             break;
         }
         case MOD_NETWORK_SOCK_DGRAM: {
@@ -1196,13 +1652,22 @@ mp_obj_t lwip_socket_send(mp_obj_t self_in, mp_obj_t buf_in) {
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_2(lwip_socket_send_obj, lwip_socket_send);
 
+// Buffer size argument of recv(), recvfrom() and recvfrom_many()
+STATIC mp_int_t lwip_socket_get_bufsize(mp_obj_t len_in) {
+    mp_int_t len = mp_obj_get_int(len_in);
+    if (len < 0) {
+        nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, "negative buffersize"));
+    }
+    return len;
+}
+
 mp_obj_t lwip_socket_recv(mp_obj_t self_in, mp_obj_t len_in) {
     lwip_socket_obj_t *socket = self_in;
     int _errno;
 
     lwip_socket_check_connected(socket);
 
-    mp_int_t len = mp_obj_get_int(len_in);
+    mp_int_t len = lwip_socket_get_bufsize(len_in);
     vstr_t vstr;
     vstr_init_len(&vstr, len);
 
@@ -1230,6 +1695,66 @@ mp_obj_t lwip_socket_recv(mp_obj_t self_in, mp_obj_t len_in) {
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_2(lwip_socket_recv_obj, lwip_socket_recv);
 
+// Helper for recv_into/recvfrom_into: receives into the writable buffer
+// args[1], limited to args[2] bytes if given and non-zero
+STATIC mp_uint_t lwip_socket_recv_into_helper(mp_uint_t n_args, const mp_obj_t *args, byte *ip, mp_uint_t *port) {
+    lwip_socket_obj_t *socket = args[0];
+    int _errno;
+
+    lwip_socket_check_connected(socket);
+
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[1], &bufinfo, MP_BUFFER_WRITE);
+    mp_uint_t len = bufinfo.len;
+    if (n_args > 2) {
+        mp_int_t n = mp_obj_get_int(args[2]);
+        if (n < 0 || (mp_uint_t)n > len) {
+            nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EINVAL)));
+        }
+        if (n > 0) {
+            len = n;
+        }
+    }
+
+    mp_uint_t ret = 0;
+    switch (socket->type) {
+        case MOD_NETWORK_SOCK_STREAM: {
+            if (ip != NULL) {
+                memcpy(ip, &socket->peer, sizeof(socket->peer));
+                *port = (mp_uint_t) socket->peer_port;
+            }
+            ret = lwip_tcp_receive(socket, bufinfo.buf, len, &_errno);
+            break;
+        }
+        case MOD_NETWORK_SOCK_DGRAM: {
+            ret = lwip_udp_receive(socket, bufinfo.buf, len, ip, port, &_errno);
+            break;
+        }
+    }
+    if (ret == -1) {
+        nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(_errno)));
+    }
+    return ret;
+}
+
+// recv_into(buf[, nbytes]): like recv(), but into a bytearray/memoryview;
+// returns the number of bytes received
+mp_obj_t lwip_socket_recv_into(mp_uint_t n_args, const mp_obj_t *args) {
+    return MP_OBJ_NEW_SMALL_INT(lwip_socket_recv_into_helper(n_args, args, NULL, NULL));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(lwip_socket_recv_into_obj, 2, 3, lwip_socket_recv_into);
+
+// recvfrom_into(buf[, nbytes]): returns (number of bytes, address)
+mp_obj_t lwip_socket_recvfrom_into(mp_uint_t n_args, const mp_obj_t *args) {
+    byte ip[4];
+    mp_uint_t port;
+    mp_obj_t tuple[2];
+    tuple[0] = MP_OBJ_NEW_SMALL_INT(lwip_socket_recv_into_helper(n_args, args, ip, &port));
+    tuple[1] = netutils_format_inet_addr(ip, port, NETUTILS_BIG);
+    return mp_obj_new_tuple(2, tuple);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(lwip_socket_recvfrom_into_obj, 2, 3, lwip_socket_recvfrom_into);
+
 mp_obj_t lwip_socket_sendto(mp_obj_t self_in, mp_obj_t data_in, mp_obj_t addr_in) {
     lwip_socket_obj_t *socket = self_in;
     int _errno;
@@ -1245,7 +1770,8 @@ mp_obj_t lwip_socket_sendto(mp_obj_t self_in, mp_obj_t data_in, mp_obj_t addr_in
     mp_uint_t ret = 0;
     switch (socket->type) {
         case MOD_NETWORK_SOCK_STREAM: {
-            ret = lwip_tcp_send(socket, bufinfo.buf, bufinfo.len, &_errno);
+            mp_obj_t pin_obj = lwip_can_pin(data_in, bufinfo.len) ? data_in : MP_OBJ_NULL;
+            ret = lwip_tcp_send(socket, bufinfo.buf, bufinfo.len, pin_obj, &_errno);
             break;
         }
         case MOD_NETWORK_SOCK_DGRAM: {
@@ -1267,7 +1793,7 @@ mp_obj_t lwip_socket_recvfrom(mp_obj_t self_in, mp_obj_t len_in) {
 
     lwip_socket_check_connected(socket);
 
-    mp_int_t len = mp_obj_get_int(len_in);
+    mp_int_t len = lwip_socket_get_bufsize(len_in);
     vstr_t vstr;
     vstr_init_len(&vstr, len);
     byte ip[4];
@@ -1302,6 +1828,100 @@ mp_obj_t lwip_socket_recvfrom(mp_obj_t self_in, mp_obj_t len_in) {
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_2(lwip_socket_recvfrom_obj, lwip_socket_recvfrom);
 
+// recvfrom_many(n, bufsize): waits like recvfrom() for the first datagram,
+// then takes up to n queued datagrams; returns a list of (bytes, address)
+mp_obj_t lwip_socket_recvfrom_many(mp_obj_t self_in, mp_obj_t n_in, mp_obj_t len_in) {
+    lwip_socket_obj_t *socket = self_in;
+    int _errno;
+
+    lwip_socket_check_connected(socket);
+    if (socket->type != MOD_NETWORK_SOCK_DGRAM) {
+        nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EOPNOTSUPP)));
+    }
+
+    mp_int_t n = mp_obj_get_int(n_in);
+    if (n < 1) {
+        nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, "n must be positive"));
+    }
+    mp_int_t len = lwip_socket_get_bufsize(len_in);
+    mp_obj_t list = mp_obj_new_list(0, NULL);
+
+    for (mp_int_t i = 0; i < n; i++) {
+        if (i > 0 && socket->udp_q_len == 0) {
+            break;
+        }
+        // no larger than the datagram, if there is one already
+        mp_int_t size = len;
+        if (socket->udp_q_len > 0 && socket->udp_q[socket->udp_q_head].p->tot_len < size) {
+            size = socket->udp_q[socket->udp_q_head].p->tot_len;
+        }
+        vstr_t vstr;
+        vstr_init_len(&vstr, size);
+        byte ip[4];
+        mp_uint_t port;
+
+        mp_uint_t ret = lwip_udp_receive(socket, (byte*)vstr.buf, size, ip, &port, &_errno);
+        if (ret == -1) {
+            nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(_errno)));
+        }
+
+        mp_obj_t tuple[2];
+        if (ret == 0) {
+            tuple[0] = mp_const_empty_bytes;
+        } else {
+            vstr.len = ret;
+            tuple[0] = mp_obj_new_str_from_vstr(&mp_type_bytes, &vstr);
+        }
+        tuple[1] = netutils_format_inet_addr(ip, port, NETUTILS_BIG);
+        mp_obj_list_append(list, mp_obj_new_tuple(2, tuple));
+    }
+    return list;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(lwip_socket_recvfrom_many_obj, lwip_socket_recvfrom_many);
+
+// dropped(): number of datagrams dropped because the receive queue was full
+mp_obj_t lwip_socket_dropped(mp_obj_t self_in) {
+    lwip_socket_obj_t *socket = self_in;
+    return mp_obj_new_int_from_uint(socket->udp_drops);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(lwip_socket_dropped_obj, lwip_socket_dropped);
+
+// sendmany(iterable): sends each (buf, address) pair as a datagram; returns
+// the number sent. An error is raised if the first one fails, otherwise
+// sending stops there and the count so far is returned.
+mp_obj_t lwip_socket_sendmany(mp_obj_t self_in, mp_obj_t dgrams_in) {
+    lwip_socket_obj_t *socket = self_in;
+    int _errno;
+
+    lwip_socket_check_connected(socket);
+    if (socket->type != MOD_NETWORK_SOCK_DGRAM) {
+        nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EOPNOTSUPP)));
+    }
+
+    mp_uint_t count = 0;
+    mp_obj_t iter = mp_getiter(dgrams_in);
+    mp_obj_t item;
+    while ((item = mp_iternext(iter)) != MP_OBJ_STOP_ITERATION) {
+        mp_obj_t *dgram;
+        mp_obj_get_array_fixed_n(item, 2, &dgram);
+
+        mp_buffer_info_t bufinfo;
+        mp_get_buffer_raise(dgram[0], &bufinfo, MP_BUFFER_READ);
+        uint8_t ip[NETUTILS_IPV4ADDR_BUFSIZE];
+        mp_uint_t port = netutils_parse_inet_addr(dgram[1], ip, NETUTILS_BIG);
+
+        if (lwip_udp_send(socket, bufinfo.buf, bufinfo.len, ip, port, &_errno) == -1) {
+            if (count == 0) {
+                nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(_errno)));
+            }
+            break;
+        }
+        count++;
+    }
+    return mp_obj_new_int_from_uint(count);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(lwip_socket_sendmany_obj, lwip_socket_sendmany);
+
 mp_obj_t lwip_socket_sendall(mp_obj_t self_in, mp_obj_t buf_in) {
     lwip_socket_obj_t *socket = self_in;
     lwip_socket_check_connected(socket);
@@ -1325,8 +1945,9 @@ mp_obj_t lwip_socket_sendall(mp_obj_t self_in, mp_obj_t buf_in) {
             }
             // TODO: In CPython3.5, socket timeout should apply to the
             // entire sendall() operation, not to individual send() chunks.
+            mp_obj_t pin_obj = lwip_can_pin(buf_in, bufinfo.len) ? buf_in : MP_OBJ_NULL;
             while (bufinfo.len != 0) {
-                ret = lwip_tcp_send(socket, bufinfo.buf, bufinfo.len, &_errno);
+                ret = lwip_tcp_send(socket, bufinfo.buf, bufinfo.len, pin_obj, &_errno);
                 if (ret == -1) {
                     nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(_errno)));
                 }
@@ -1398,6 +2019,17 @@ mp_obj_t lwip_socket_setsockopt(mp_uint_t n_args, const mp_obj_t *args) {
                 ip_reset_option(socket->pcb.tcp, SOF_REUSEADDR);
             }
             break;
+        case MOD_NETWORK_SO_RCVBUF:
+            // Bound of the payload queued by a UDP socket; TCP sockets
+            // advertise the fixed lwIP window instead
+            if (socket->type != MOD_NETWORK_SOCK_DGRAM) {
+                nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EOPNOTSUPP)));
+            }
+            if (val <= 0) {
+                nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EINVAL)));
+            }
+            socket->udp_rcvbuf = val;
+            break;
         default:
             printf("Warning: lwip.setsockopt() not implemented\n");
     }
@@ -1405,6 +2037,26 @@ mp_obj_t lwip_socket_setsockopt(mp_uint_t n_args, const mp_obj_t *args) {
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(lwip_socket_setsockopt_obj, 4, 4, lwip_socket_setsockopt);
 
+mp_obj_t lwip_socket_getsockopt(mp_obj_t self_in, mp_obj_t level_in, mp_obj_t opt_in) {
+    lwip_socket_obj_t *socket = self_in;
+    (void)level_in;
+
+    switch (mp_obj_get_int(opt_in)) {
+        case MOD_NETWORK_SO_ERROR:
+            // The error that reset or aborted the socket, e.g. a failed
+            // non-blocking connect(); 0 while it is new or connected
+            return MP_OBJ_NEW_SMALL_INT(socket->state < 0 ? error_lookup_table[-socket->state] : 0);
+        case MOD_NETWORK_SO_RCVBUF:
+            if (socket->type != MOD_NETWORK_SOCK_DGRAM) {
+                nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EOPNOTSUPP)));
+            }
+            return mp_obj_new_int_from_uint(socket->udp_rcvbuf);
+        default:
+            nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EOPNOTSUPP)));
+    }
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(lwip_socket_getsockopt_obj, lwip_socket_getsockopt);
+
 mp_obj_t lwip_socket_makefile(mp_uint_t n_args, const mp_obj_t *args) {
     (void)n_args;
     return args[0];
@@ -1429,7 +2081,7 @@ mp_uint_t lwip_socket_write(mp_obj_t self_in, const void *buf, mp_uint_t size, i
 
     switch (socket->type) {
         case MOD_NETWORK_SOCK_STREAM:
-            return lwip_tcp_send(socket, buf, size, errcode);
+            return lwip_tcp_send(socket, buf, size, MP_OBJ_NULL, errcode);
         case MOD_NETWORK_SOCK_DGRAM:
             return lwip_udp_send(socket, buf, size, NULL, 0, errcode);
     }
@@ -1444,26 +2096,43 @@ STATIC const mp_map_elem_t lwip_socket_locals_dict_table[] = {
     { MP_OBJ_NEW_QSTR(MP_QSTR_bind), (mp_obj_t)&lwip_socket_bind_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_listen), (mp_obj_t)&lwip_socket_listen_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_accept), (mp_obj_t)&lwip_socket_accept_obj },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_accept_many), (mp_obj_t)&lwip_socket_accept_many_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_connect), (mp_obj_t)&lwip_socket_connect_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_send), (mp_obj_t)&lwip_socket_send_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_recv), (mp_obj_t)&lwip_socket_recv_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_sendto), (mp_obj_t)&lwip_socket_sendto_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_recvfrom), (mp_obj_t)&lwip_socket_recvfrom_obj },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_recv_into), (mp_obj_t)&lwip_socket_recv_into_obj },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_recvfrom_into), (mp_obj_t)&lwip_socket_recvfrom_into_obj },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_recvfrom_many), (mp_obj_t)&lwip_socket_recvfrom_many_obj },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_dropped), (mp_obj_t)&lwip_socket_dropped_obj },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_sendmany), (mp_obj_t)&lwip_socket_sendmany_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_sendall), (mp_obj_t)&lwip_socket_sendall_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_settimeout), (mp_obj_t)&lwip_socket_settimeout_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_setblocking), (mp_obj_t)&lwip_socket_setblocking_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_setsockopt), (mp_obj_t)&lwip_socket_setsockopt_obj },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_getsockopt), (mp_obj_t)&lwip_socket_getsockopt_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_makefile), (mp_obj_t)&lwip_socket_makefile_obj },
 
     { MP_OBJ_NEW_QSTR(MP_QSTR_read), (mp_obj_t)&mp_stream_read_obj },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_readinto), (mp_obj_t)&mp_stream_readinto_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_readline), (mp_obj_t)&mp_stream_unbuffered_readline_obj},
     { MP_OBJ_NEW_QSTR(MP_QSTR_write), (mp_obj_t)&mp_stream_write_obj },
 };
 STATIC MP_DEFINE_CONST_DICT(lwip_socket_locals_dict, lwip_socket_locals_dict_table);
 
+STATIC mp_uint_t lwip_socket_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode) {
+    if (request == MP_STREAM_POLL) {
+        return lwip_socket_poll(self_in, arg);
+    }
+    *errcode = EINVAL;
+    return MP_STREAM_ERROR;
+}
+
 STATIC const mp_stream_p_t lwip_socket_stream_p = {
     .read = lwip_socket_read,
     .write = lwip_socket_write,
+    .ioctl = lwip_socket_ioctl,
 };
 
 STATIC const mp_obj_type_t lwip_socket_type = {
@@ -1475,6 +2144,154 @@ STATIC const mp_obj_type_t lwip_socket_type = {
     .locals_dict = (mp_obj_t)&lwip_socket_locals_dict,
 };
 
+/******************************************************************************/
+// epoll-style interest set: epoll.wait() costs O(ready sockets), however
+// many sockets are registered. A socket can be registered with one set.
+
+STATIC const mp_obj_type_t lwip_epoll_type;
+
+STATIC mp_obj_t lwip_epoll_make_new(const mp_obj_type_t *type, mp_uint_t n_args, mp_uint_t n_kw, const mp_obj_t *args) {
+    mp_arg_check_num(n_args, n_kw, 0, 0, false);
+
+    lwip_epoll_obj_t *ep = m_new_obj(lwip_epoll_obj_t);
+    ep->base.type = (mp_obj_t)&lwip_epoll_type;
+    ep->socks = NULL;
+    ep->socks_alloc = 0;
+    ep->socks_len = 0;
+    ep->ready_head = NULL;
+    ep->ready_tail = NULL;
+    ep->ready_len = 0;
+    return ep;
+}
+
+STATIC lwip_socket_obj_t *lwip_epoll_get_socket(mp_obj_t sock_in) {
+    if (mp_obj_get_type(sock_in) != &lwip_socket_type) {
+        nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EBADF)));
+    }
+    return sock_in;
+}
+
+// epoll.register(sock[, eventmask]); eventmask defaults to POLLIN|POLLOUT,
+// errors and hang-ups are always reported
+STATIC mp_obj_t lwip_epoll_register(mp_uint_t n_args, const mp_obj_t *args) {
+    lwip_epoll_obj_t *ep = args[0];
+    lwip_socket_obj_t *socket = lwip_epoll_get_socket(args[1]);
+    mp_uint_t events = EVLOOP_IO_RD | EVLOOP_IO_WR;
+    if (n_args > 2) {
+        events = mp_obj_get_int(args[2]);
+    }
+
+    if (socket->pcb.tcp == NULL) {
+        nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EBADF)));
+    }
+    if (socket->ep != NULL) {
+        nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EEXIST)));
+    }
+    if (ep->socks_len == ep->socks_alloc) {
+        uint16_t n = ep->socks_alloc ? ep->socks_alloc * 2 : 8;
+        ep->socks = m_renew(lwip_socket_obj_t*, ep->socks, ep->socks_alloc, n);
+        ep->socks_alloc = n;
+    }
+    socket->ep = ep;
+    socket->ep_events = events;
+    socket->ep_index = ep->socks_len;
+    ep->socks[ep->socks_len++] = socket;
+    lwip_epoll_notify(socket);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(lwip_epoll_register_obj, 2, 3, lwip_epoll_register);
+
+// epoll.modify(sock, eventmask)
+STATIC mp_obj_t lwip_epoll_modify(mp_obj_t self_in, mp_obj_t sock_in, mp_obj_t events_in) {
+    lwip_epoll_obj_t *ep = self_in;
+    lwip_socket_obj_t *socket = lwip_epoll_get_socket(sock_in);
+
+    if (socket->ep != ep) {
+        nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(ENOENT)));
+    }
+    socket->ep_events = mp_obj_get_int(events_in);
+    lwip_epoll_notify(socket);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(lwip_epoll_modify_obj, lwip_epoll_modify);
+
+// epoll.unregister(sock); closed sockets are unregistered by close()
+STATIC mp_obj_t lwip_epoll_unregister(mp_obj_t self_in, mp_obj_t sock_in) {
+    lwip_epoll_obj_t *ep = self_in;
+    lwip_socket_obj_t *socket = lwip_epoll_get_socket(sock_in);
+
+    if (socket->ep == ep) {
+        lwip_epoll_del(socket);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(lwip_epoll_unregister_obj, lwip_epoll_unregister);
+
+typedef struct _lwip_epoll_wait_t {
+    lwip_epoll_obj_t *ep;
+    mp_obj_t list;
+    mp_uint_t max;
+} lwip_epoll_wait_t;
+
+// Appends (sock, events) for up to max ready sockets to the list; true if
+// there were any. Every socket on the ready list is looked at once: those
+// still ready are moved to its end, so that a limit on the events returned
+// does not starve any socket.
+STATIC bool lwip_epoll_collect(void *arg) {
+    lwip_epoll_wait_t *w = arg;
+    mp_uint_t n = w->ep->ready_len;
+    mp_uint_t found = 0;
+
+    while (n-- > 0 && (w->max == 0 || found < w->max)) {
+        lwip_socket_obj_t *socket = w->ep->ready_head;
+        mp_uint_t events = lwip_socket_poll(socket, socket->ep_events);
+        lwip_epoll_unready(socket);
+        if (events) {
+            lwip_epoll_notify(socket);
+            mp_obj_t tuple[2] = { socket, MP_OBJ_NEW_SMALL_INT(events) };
+            mp_obj_list_append(w->list, mp_obj_new_tuple(2, tuple));
+            found++;
+        }
+    }
+    return found > 0;
+}
+
+// epoll.wait([timeout_ms[, maxevents]]): returns a list of (sock, events)
+// for ready sockets, waiting up to timeout_ms (forever if negative, the
+// default) for one to become ready; maxevents=0 means no limit
+STATIC mp_obj_t lwip_epoll_wait(mp_uint_t n_args, const mp_obj_t *args) {
+    lwip_epoll_wait_t w;
+    mp_int_t timeout = -1;
+    w.ep = args[0];
+    w.max = 0;
+    if (n_args > 1 && args[1] != mp_const_none) {
+        timeout = mp_obj_get_int(args[1]);
+    }
+    if (n_args > 2) {
+        w.max = mp_obj_get_int(args[2]);
+    }
+
+    w.list = mp_obj_new_list(0, NULL);
+    evloop_wait(lwip_epoll_collect, &w, timeout);
+    return w.list;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(lwip_epoll_wait_obj, 1, 3, lwip_epoll_wait);
+
+STATIC const mp_map_elem_t lwip_epoll_locals_dict_table[] = {
+    { MP_OBJ_NEW_QSTR(MP_QSTR_register), (mp_obj_t)&lwip_epoll_register_obj },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_modify), (mp_obj_t)&lwip_epoll_modify_obj },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_unregister), (mp_obj_t)&lwip_epoll_unregister_obj },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_wait), (mp_obj_t)&lwip_epoll_wait_obj },
+};
+STATIC MP_DEFINE_CONST_DICT(lwip_epoll_locals_dict, lwip_epoll_locals_dict_table);
+
+STATIC const mp_obj_type_t lwip_epoll_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_epoll,
+    .make_new = lwip_epoll_make_new,
+    .locals_dict = (mp_obj_t)&lwip_epoll_locals_dict,
+};
+
 /******************************************************************************/
 // Support functions for memory protection. lwIP has its own memory management
 // routines for its internal structures, and since they might be called in
@@ -1557,17 +2374,6 @@ STATIC mp_obj_t mod_lwip_reset() {
 }
 MP_DEFINE_CONST_FUN_OBJ_0(mod_lwip_reset_obj, mod_lwip_reset);
 
-/*
-STATIC mp_obj_t mod_lwip_callback() {
-    if (lwip_poll_list.poll != NULL) {
-        lwip_poll_list.poll(lwip_poll_list.poll_arg);
-    }
-    sys_check_timeouts();
-    return mp_const_none;
-    }*/
-
-//MP_DEFINE_CONST_FUN_OBJ_0(mod_lwip_callback_obj, mod_lwip_callback);
-
 typedef struct _getaddrinfo_state_t {
     volatile int status;
     volatile ip_addr_t ipaddr;
@@ -1585,6 +2391,11 @@ STATIC void lwip_getaddrinfo_cb(const char *name, ip_addr_t *ipaddr, void *arg)
     }
 }
 
+STATIC bool lwip_getaddrinfo_done(void *arg) {
+    getaddrinfo_state_t *state = arg;
+    return state->status != 0;
+}
+
 // lwip.getaddrinfo
 mp_obj_t lwip_getaddrinfo(mp_obj_t host_in, mp_obj_t port_in) {
     mp_uint_t hlen;
@@ -1594,6 +2405,9 @@ mp_obj_t lwip_getaddrinfo(mp_obj_t host_in, mp_obj_t port_in) {
     getaddrinfo_state_t state;
     state.status = 0;
 
+    // lwIP keeps a pointer to state until the query completes, so fail
+    // before starting one that could not be waited for
+    evloop_check_busy();
     err_t ret = dns_gethostbyname(host, (ip_addr_t*)&state.ipaddr, lwip_getaddrinfo_cb, &state);
     switch (ret) {
         case ERR_OK:
@@ -1601,9 +2415,11 @@ mp_obj_t lwip_getaddrinfo(mp_obj_t host_in, mp_obj_t port_in) {
             state.status = 1;
             break;
         case ERR_INPROGRESS:
-            while (state.status == 0) {
-                poll_sockets();
-            }
+            // lwIP writes to state (on our stack) when the query ends,
+            // which it always does (answer, error or timeout): raising
+            // a Ctrl-C before that would leave it a dangling pointer
+            evloop_wait_nointr(lwip_getaddrinfo_done, &state, -1);
+            evloop_check_pending();
             break;
         default:
             state.status = ret;
@@ -1648,6 +2464,7 @@ STATIC const mp_map_elem_t mp_module_lwip_globals_table[] = {
     { MP_OBJ_NEW_QSTR(MP_QSTR_slip), (mp_obj_t)&lwip_slip_type },
 #endif
     { MP_OBJ_NEW_QSTR(MP_QSTR_ether), (mp_obj_t)&lwip_ether_type },    
+    { MP_OBJ_NEW_QSTR(MP_QSTR_epoll), (mp_obj_t)&lwip_epoll_type },
     // class constants
     { MP_OBJ_NEW_QSTR(MP_QSTR_AF_INET), MP_OBJ_NEW_SMALL_INT(MOD_NETWORK_AF_INET) },
     { MP_OBJ_NEW_QSTR(MP_QSTR_AF_INET6), MP_OBJ_NEW_SMALL_INT(MOD_NETWORK_AF_INET6) },
@@ -1658,6 +2475,13 @@ STATIC const mp_map_elem_t mp_module_lwip_globals_table[] = {
 
     { MP_OBJ_NEW_QSTR(MP_QSTR_SOL_SOCKET), MP_OBJ_NEW_SMALL_INT(1) },
     { MP_OBJ_NEW_QSTR(MP_QSTR_SO_REUSEADDR), MP_OBJ_NEW_SMALL_INT(SOF_REUSEADDR) },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_SO_RCVBUF), MP_OBJ_NEW_SMALL_INT(MOD_NETWORK_SO_RCVBUF) },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_SO_ERROR), MP_OBJ_NEW_SMALL_INT(MOD_NETWORK_SO_ERROR) },
+
+    { MP_OBJ_NEW_QSTR(MP_QSTR_POLLIN), MP_OBJ_NEW_SMALL_INT(EVLOOP_IO_RD) },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_POLLOUT), MP_OBJ_NEW_SMALL_INT(EVLOOP_IO_WR) },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_POLLERR), MP_OBJ_NEW_SMALL_INT(EVLOOP_IO_ERR) },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_POLLHUP), MP_OBJ_NEW_SMALL_INT(EVLOOP_IO_HUP) },
 };
 
 STATIC MP_DEFINE_CONST_DICT(mp_module_lwip_globals, mp_module_lwip_globals_table);
@@ -47,6 +47,20 @@
 #include "lwip/inet.h"
 #include <mini-os/lwip-net.h>
 
+// Datagram waiting in the receive queue of a UDP socket
+typedef struct _lwip_dgram_t {
+    struct pbuf *p;
+    byte ip[4];
+    uint16_t port;
+} lwip_dgram_t;
+
+// Object sent without copying; lwIP refers to its buffer until the
+// stream has been acknowledged up to byte offset end
+typedef struct _lwip_pin_t {
+    mp_obj_t obj;
+    uint32_t end;
+} lwip_pin_t;
+
 typedef struct _lwip_socket_obj_t {
     mp_obj_base_t base;
 
@@ -54,16 +68,58 @@ typedef struct _lwip_socket_obj_t {
         struct tcp_pcb *tcp;
         struct udp_pcb *udp;
     } pcb;
-    volatile union {
-        struct pbuf *pbuf;
-        struct tcp_pcb *connection;
-    } incoming;
     mp_obj_t callback;
     byte peer[4];
     mp_uint_t peer_port;
     mp_uint_t timeout;
     uint16_t leftover_count;
 
+    // TCP receive queue: pbuf chains delivered by lwIP, oldest first;
+    // leftover_count is what is left to read of the oldest one
+    struct pbuf *recv_q[MICROPY_PY_LWIP_TCP_RECV_QUEUE];
+    uint8_t recv_q_head;
+    uint8_t recv_q_len;
+    uint32_t recv_q_bytes;
+
+    // Listening TCP socket: ring of established connections waiting for
+    // accept(), sized by the listen() backlog. A connection that is reset
+    // while waiting is set to NULL by its error callback.
+    struct tcp_pcb **accept_q;
+    uint8_t accept_q_alloc;
+    uint8_t accept_q_head;
+    uint8_t accept_q_len;
+
+    // UDP receive queue (MICROPY_PY_LWIP_UDP_RECV_QUEUE entries), oldest
+    // first; the queued payload is bounded by udp_rcvbuf (SO_RCVBUF)
+    lwip_dgram_t *udp_q;
+    uint16_t udp_q_head;
+    uint16_t udp_q_len;
+    uint32_t udp_q_bytes;
+    uint32_t udp_rcvbuf;
+    uint32_t udp_drops; // datagrams dropped because the queue was full
+
+    // Zero-copy TCP send: ring of pinned objects, oldest first. Sockets
+    // with pins are chained from MP_STATE_PORT(lwip_pinned), so neither
+    // they nor the pinned objects are collected while lwIP refers to them.
+    lwip_pin_t *pins;
+    uint16_t pins_alloc;
+    uint16_t pins_head;
+    uint16_t pins_len;
+    uint32_t sent_bytes;  // handed to tcp_write()
+    uint32_t acked_bytes; // reported by the tcp_sent callback
+    struct _lwip_socket_obj_t *pinned_prev;
+    struct _lwip_socket_obj_t *pinned_next;
+
+    // Interest set (lwip.epoll) the socket is registered with, if any.
+    // Callbacks that may change its readiness put it on the set's ready
+    // list; epoll.wait() drops it from there once it is no longer ready.
+    struct _lwip_epoll_obj_t *ep;
+    uint16_t ep_events;
+    uint16_t ep_index; // position in ep->socks
+    bool ep_ready;     // on the ready list
+    struct _lwip_socket_obj_t *ep_prev;
+    struct _lwip_socket_obj_t *ep_next;
+
     uint8_t domain;
     uint8_t type;
 
@@ -75,6 +131,16 @@ typedef struct _lwip_socket_obj_t {
     int8_t state;
 } lwip_socket_obj_t;
 
+typedef struct _lwip_epoll_obj_t {
+    mp_obj_base_t base;
+    lwip_socket_obj_t **socks; // registered sockets
+    uint16_t socks_alloc;
+    uint16_t socks_len;
+    lwip_socket_obj_t *ready_head;
+    lwip_socket_obj_t *ready_tail;
+    uint16_t ready_len;
+} lwip_epoll_obj_t;
+
 struct mcargs {
   struct eth_addr mac;
   struct netif    netif;
@@ -93,16 +159,23 @@ mp_obj_t lwip_socket_close(mp_obj_t self_in);
 mp_obj_t lwip_socket_bind(mp_obj_t self_in, mp_obj_t addr_in);
 mp_obj_t lwip_socket_listen(mp_obj_t self_in, mp_obj_t backlog_in);
 mp_obj_t lwip_socket_accept(mp_obj_t self_in);
+mp_obj_t lwip_socket_accept_many(mp_obj_t self_in, mp_obj_t n_in);
 mp_obj_t lwip_socket_connect(mp_obj_t self_in, mp_obj_t addr_in);
 void lwip_socket_check_connected(lwip_socket_obj_t *socket);
 mp_obj_t lwip_socket_send(mp_obj_t self_in, mp_obj_t buf_in);
 mp_obj_t lwip_socket_recv(mp_obj_t self_in, mp_obj_t len_in);
 mp_obj_t lwip_socket_sendto(mp_obj_t self_in, mp_obj_t data_in, mp_obj_t addr_in);
 mp_obj_t lwip_socket_recvfrom(mp_obj_t self_in, mp_obj_t len_in);
+mp_obj_t lwip_socket_recv_into(mp_uint_t n_args, const mp_obj_t *args);
+mp_obj_t lwip_socket_recvfrom_into(mp_uint_t n_args, const mp_obj_t *args);
+mp_obj_t lwip_socket_recvfrom_many(mp_obj_t self_in, mp_obj_t n_in, mp_obj_t len_in);
+mp_obj_t lwip_socket_dropped(mp_obj_t self_in);
+mp_obj_t lwip_socket_sendmany(mp_obj_t self_in, mp_obj_t dgrams_in);
 mp_obj_t lwip_socket_sendall(mp_obj_t self_in, mp_obj_t buf_in);
 mp_obj_t lwip_socket_settimeout(mp_obj_t self_in, mp_obj_t timeout_in);
 mp_obj_t lwip_socket_setblocking(mp_obj_t self_in, mp_obj_t flag_in);
 mp_obj_t lwip_socket_setsockopt(mp_uint_t n_args, const mp_obj_t *args);
+mp_obj_t lwip_socket_getsockopt(mp_obj_t self_in, mp_obj_t level_in, mp_obj_t opt_in);
 mp_obj_t lwip_socket_makefile(mp_uint_t n_args, const mp_obj_t *args);
 mp_uint_t lwip_socket_read(mp_obj_t self_in, void *buf, mp_uint_t size, int *errcode);
 mp_uint_t lwip_socket_write(mp_obj_t self_in, const void *buf, mp_uint_t size, int *errcode);
@@ -0,0 +1,223 @@
+/*
+ * Minipython, a Xen-based Unikernel.
+ *
+ * Authors:  Felipe Huici <felipe.huici@neclab.eu>
+ *           Simon Kuenzer <simon.kuenzer@neclab.eu>
+ *
+ *
+ * Copyright (c) 2013-2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "py/runtime.h"
+#include "minipython.h"
+
+/* Port-specific knobs of the interpreter */
+
+#if MICROPY_TIERING
+// tiering() -> (threshold, emitter)
+// tiering(threshold[, emitter]): scripts run more than threshold times
+// are recompiled with emitter ('native' or 'viper'); None disables
+// promotion. Changing the policy drops all promoted code and counts.
+STATIC mp_obj_t mod_minipython_tiering(size_t n_args, const mp_obj_t *args) {
+    if (n_args == 0) {
+        mp_obj_t tuple[2] = {
+            tier_threshold < 0 ? mp_const_none : MP_OBJ_NEW_SMALL_INT(tier_threshold),
+            MP_OBJ_NEW_QSTR(tier_emit_opt == MP_EMIT_OPT_VIPER ? MP_QSTR_viper : MP_QSTR_native),
+        };
+        return mp_obj_new_tuple(2, tuple);
+    }
+
+    if (n_args > 1) {
+        qstr emitter = mp_obj_str_get_qstr(args[1]);
+        if (emitter == MP_QSTR_native) {
+            tier_emit_opt = MP_EMIT_OPT_NATIVE_PYTHON;
+        } else if (emitter == MP_QSTR_viper) {
+            tier_emit_opt = MP_EMIT_OPT_VIPER;
+        } else {
+            nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, "unknown emitter"));
+        }
+    }
+    tier_threshold = args[0] == mp_const_none ? -1 : mp_obj_get_int(args[0]);
+    tier_reset();
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mod_minipython_tiering_obj, 0, 2, mod_minipython_tiering);
+#endif
+
+#if MICROPY_GC_STATS
+// gc_stats() -> dict with the number of collections, total and maximum
+// pause (us), the pause histogram and the last collections as
+// (pause_us, reclaimed, live, frag_percent) tuples, oldest first
+STATIC mp_obj_t mod_minipython_gc_stats(void) {
+    mp_obj_t dict = mp_obj_new_dict(5);
+    mp_obj_t hist = mp_obj_new_list(0, NULL);
+    mp_obj_t recent = mp_obj_new_list(0, NULL);
+    uint32_t nb = gc_stats.nb_collections;
+    uint32_t n = nb < GC_STATS_RING_LEN ? nb : GC_STATS_RING_LEN;
+
+    for (int i = 0; i < GC_STATS_NB_BUCKETS; ++i) {
+        mp_obj_list_append(hist, mp_obj_new_int_from_uint(gc_stats.hist[i]));
+    }
+    for (uint32_t i = nb - n; i < nb; ++i) {
+        struct gc_stats_sample *s = &gc_stats.ring[i % GC_STATS_RING_LEN];
+        mp_obj_t sample[4] = {
+            mp_obj_new_int_from_uint(s->pause_us),
+            mp_obj_new_int_from_uint(s->reclaimed),
+            mp_obj_new_int_from_uint(s->live),
+            MP_OBJ_NEW_SMALL_INT(s->frag),
+        };
+        mp_obj_list_append(recent, mp_obj_new_tuple(4, sample));
+    }
+
+    mp_obj_dict_store(dict, MP_OBJ_NEW_QSTR(MP_QSTR_collections), mp_obj_new_int_from_uint(nb));
+    mp_obj_dict_store(dict, MP_OBJ_NEW_QSTR(MP_QSTR_pause_total_us), mp_obj_new_int_from_ull(gc_stats.pause_total_us));
+    mp_obj_dict_store(dict, MP_OBJ_NEW_QSTR(MP_QSTR_pause_max_us), mp_obj_new_int_from_uint(gc_stats.pause_max_us));
+    mp_obj_dict_store(dict, MP_OBJ_NEW_QSTR(MP_QSTR_histogram), hist);
+    mp_obj_dict_store(dict, MP_OBJ_NEW_QSTR(MP_QSTR_recent), recent);
+    return dict;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(mod_minipython_gc_stats_obj, mod_minipython_gc_stats);
+
+// gc_dump(): prints the statistics to the console
+STATIC mp_obj_t mod_minipython_gc_dump(void) {
+    gc_stats_dump();
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(mod_minipython_gc_dump_obj, mod_minipython_gc_dump);
+#endif
+
+#if MICROPY_ALLOC_PROFILE || MICROPY_VM_PROFILE
+#if MICROPY_VFS_FAT
+STATIC void fat_print_strn(void *env, const char *str, size_t len) {
+    UINT n;
+    f_write((FIL*)env, str, len, &n);
+}
+#endif
+
+// Runs dump on the console, or on a file on the FAT volume if a path is
+// given; returns the number of lines written
+STATIC mp_obj_t profile_dump(size_t n_args, const mp_obj_t *args, unsigned int (*dump)(const mp_print_t *)) {
+    unsigned int n;
+
+    if (n_args == 0) {
+        n = dump(&mp_plat_print);
+        return MP_OBJ_NEW_SMALL_INT(n);
+    }
+    #if MICROPY_VFS_FAT
+    FIL fp;
+    if (f_open(&fp, mp_obj_str_get_str(args[0]), FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+        nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EIO)));
+    }
+    mp_print_t print = {&fp, fat_print_strn};
+    n = dump(&print);
+    f_close(&fp);
+    return MP_OBJ_NEW_SMALL_INT(n);
+    #else
+    nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(ENODEV)));
+    #endif
+}
+#endif
+
+#if MICROPY_ALLOC_PROFILE
+// alloc_profile(rate): samples the allocating call stack every rate
+// allocated bytes and clears earlier samples; 0 stops sampling
+STATIC mp_obj_t mod_minipython_alloc_profile(mp_obj_t rate_in) {
+    mp_int_t rate = mp_obj_get_int(rate_in);
+    if (rate < 0) {
+        nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, "rate must be >= 0"));
+    }
+    allocprof_start(rate);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mod_minipython_alloc_profile_obj, mod_minipython_alloc_profile);
+
+// alloc_dump([path]): writes the samples as folded stacks to the
+// console, or to a file on the FAT volume; returns the number of lines
+STATIC mp_obj_t mod_minipython_alloc_dump(size_t n_args, const mp_obj_t *args) {
+    return profile_dump(n_args, args, allocprof_dump);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mod_minipython_alloc_dump_obj, 0, 1, mod_minipython_alloc_dump);
+#endif
+
+#if MICROPY_VM_PROFILE
+// vm_profile(hz): samples the running Python function hz times per
+// second and clears earlier samples; 0 stops sampling
+STATIC mp_obj_t mod_minipython_vm_profile(mp_obj_t hz_in) {
+    mp_int_t hz = mp_obj_get_int(hz_in);
+    if (hz < 0) {
+        nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, "hz must be >= 0"));
+    }
+    vmprof_start(hz);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mod_minipython_vm_profile_obj, mod_minipython_vm_profile);
+
+// vm_dump([path]): writes the samples as collapsed stacks to the
+// console, or to a file on the FAT volume; returns the number of lines.
+// Without CONFIG_STACKLESS=y every stack has depth 1 (no callers)
+STATIC mp_obj_t mod_minipython_vm_dump(size_t n_args, const mp_obj_t *args) {
+    return profile_dump(n_args, args, vmprof_dump);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mod_minipython_vm_dump_obj, 0, 1, mod_minipython_vm_dump);
+#endif
+
+// boot_profile(): times (in microseconds since the domain was created)
+// at which the boot phases were reached
+STATIC mp_obj_t mod_minipython_boot_profile(void) {
+    return bootprof_dict();
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(mod_minipython_boot_profile_obj, mod_minipython_boot_profile);
+
+STATIC const mp_rom_map_elem_t mp_module_minipython_globals_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_minipython) },
+    { MP_ROM_QSTR(MP_QSTR_boot_profile), MP_ROM_PTR(&mod_minipython_boot_profile_obj) },
+    #if MICROPY_TIERING
+    { MP_ROM_QSTR(MP_QSTR_tiering), MP_ROM_PTR(&mod_minipython_tiering_obj) },
+    #endif
+    #if MICROPY_GC_STATS
+    { MP_ROM_QSTR(MP_QSTR_gc_stats), MP_ROM_PTR(&mod_minipython_gc_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_gc_dump), MP_ROM_PTR(&mod_minipython_gc_dump_obj) },
+    #endif
+    #if MICROPY_ALLOC_PROFILE
+    { MP_ROM_QSTR(MP_QSTR_alloc_profile), MP_ROM_PTR(&mod_minipython_alloc_profile_obj) },
+    { MP_ROM_QSTR(MP_QSTR_alloc_dump), MP_ROM_PTR(&mod_minipython_alloc_dump_obj) },
+    #endif
+    #if MICROPY_VM_PROFILE
+    { MP_ROM_QSTR(MP_QSTR_vm_profile), MP_ROM_PTR(&mod_minipython_vm_profile_obj) },
+    { MP_ROM_QSTR(MP_QSTR_vm_dump), MP_ROM_PTR(&mod_minipython_vm_dump_obj) },
+    #endif
+};
+
+STATIC MP_DEFINE_CONST_DICT(mp_module_minipython_globals, mp_module_minipython_globals_table);
+
+const mp_obj_module_t mp_module_minipython = {
+    .base = { &mp_type_module },
+    .name = MP_QSTR_minipython,
+    .globals = (mp_obj_dict_t*)&mp_module_minipython_globals,
+};
@@ -94,41 +94,28 @@ STATIC mp_obj_t mod_time_clock(void) {
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_0(mod_time_clock_obj, mod_time_clock);
 
+// Sleeps go through the event loop (see mp_hal_delay_ms()), so that
+// network timers and disk I/O progress meanwhile
 STATIC mp_obj_t mod_time_sleep(mp_obj_t arg) {
 #if MICROPY_PY_BUILTINS_FLOAT
-    struct timeval tv;
     mp_float_t val = mp_obj_get_float(arg);
-    double ipart;
-    tv.tv_usec = round(modf(val, &ipart) * 1000000);
-    tv.tv_sec = ipart;
-    int res;
-    while (1) {
-        res = sleep_select(0, NULL, NULL, NULL, &tv);
-        #if MICROPY_SELECT_REMAINING_TIME
-        // TODO: This assumes Linux behavior of modifying tv to the remaining
-        // time.
-        if (res != -1 || errno != EINTR) {
-            break;
-        }
-        if (MP_STATE_VM(mp_pending_exception) != MP_OBJ_NULL) {
-            return mp_const_none;
-        }
-        //printf("select: EINTR: %ld:%ld\n", tv.tv_sec, tv.tv_usec);
-        #else
-        break;
-        #endif
+    if (val < 0) {
+        nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, "sleep length must be non-negative"));
+    }
+    mp_uint_t us = round(val * 1000000);
+    mp_hal_delay_ms(us / 1000);
+    if (us % 1000) {
+        usleep(us % 1000);
     }
-    RAISE_ERRNO(res, errno);
 #else
-    // TODO: Handle EINTR
-    sleep(mp_obj_get_int(arg));
+    mp_hal_delay_ms(mp_obj_get_int(arg) * 1000);
 #endif
     return mp_const_none;
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_1(mod_time_sleep_obj, mod_time_sleep);
 
 STATIC mp_obj_t mod_time_sleep_ms(mp_obj_t arg) {
-    usleep(mp_obj_get_int(arg) * 1000);
+    mp_hal_delay_ms(mp_obj_get_int(arg));
     return mp_const_none;
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_1(mod_time_sleep_ms_obj, mod_time_sleep_ms);
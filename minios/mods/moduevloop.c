@@ -0,0 +1,105 @@
+/*
+ * Minipython, a Xen-based Unikernel.
+ *
+ * Authors:  Felipe Huici <felipe.huici@neclab.eu>
+ *           Simon Kuenzer <simon.kuenzer@neclab.eu>
+ *
+ *
+ * Copyright (c) 2013-2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "py/runtime.h"
+#include "py/mphal.h"
+#include "evloop.h"
+
+/* Scheduler primitives of the native event loop (see evloop.c); the
+ * frozen uasyncio module is built on top of these */
+
+// call_soon(obj): appends obj to the run queue
+STATIC mp_obj_t mod_uevloop_call_soon(mp_obj_t obj) {
+    evloop_call_soon(obj);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mod_uevloop_call_soon_obj, mod_uevloop_call_soon);
+
+// call_at(ticks_ms, obj): queues obj once utime.ticks_ms() reaches ticks_ms
+STATIC mp_obj_t mod_uevloop_call_at(mp_obj_t when_in, mp_obj_t obj) {
+    evloop_call_at(mp_obj_get_int(when_in), obj);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(mod_uevloop_call_at_obj, mod_uevloop_call_at);
+
+// wait_io(sock, flags, obj): queues obj once sock is ready for flags
+// (POLLIN and/or POLLOUT); errors and hang-ups always wake it up
+STATIC mp_obj_t mod_uevloop_wait_io(mp_obj_t sock, mp_obj_t flags_in, mp_obj_t obj) {
+    mp_uint_t flags = mp_obj_get_int(flags_in);
+
+    // fail early on objects the loop cannot poll
+    lwip_socket_poll(sock, 0);
+    evloop_wait_io(sock, flags, obj);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(mod_uevloop_wait_io_obj, mod_uevloop_wait_io);
+
+// remove_io(sock): drops all waiters of sock
+STATIC mp_obj_t mod_uevloop_remove_io(mp_obj_t sock) {
+    evloop_remove_io(sock);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mod_uevloop_remove_io_obj, mod_uevloop_remove_io);
+
+// next(): returns the next runnable object, blocking while there is
+// none; returns None when nothing is queued, pending or waited for
+STATIC mp_obj_t mod_uevloop_next(void) {
+    mp_obj_t obj = evloop_next();
+    return obj == MP_OBJ_NULL ? mp_const_none : obj;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(mod_uevloop_next_obj, mod_uevloop_next);
+
+STATIC const mp_rom_map_elem_t mp_module_uevloop_globals_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_uevloop) },
+    { MP_ROM_QSTR(MP_QSTR_call_soon), MP_ROM_PTR(&mod_uevloop_call_soon_obj) },
+    { MP_ROM_QSTR(MP_QSTR_call_at), MP_ROM_PTR(&mod_uevloop_call_at_obj) },
+    { MP_ROM_QSTR(MP_QSTR_wait_io), MP_ROM_PTR(&mod_uevloop_wait_io_obj) },
+    { MP_ROM_QSTR(MP_QSTR_remove_io), MP_ROM_PTR(&mod_uevloop_remove_io_obj) },
+    { MP_ROM_QSTR(MP_QSTR_next), MP_ROM_PTR(&mod_uevloop_next_obj) },
+
+    { MP_ROM_QSTR(MP_QSTR_POLLIN), MP_ROM_INT(EVLOOP_IO_RD) },
+    { MP_ROM_QSTR(MP_QSTR_POLLOUT), MP_ROM_INT(EVLOOP_IO_WR) },
+    { MP_ROM_QSTR(MP_QSTR_POLLERR), MP_ROM_INT(EVLOOP_IO_ERR) },
+    { MP_ROM_QSTR(MP_QSTR_POLLHUP), MP_ROM_INT(EVLOOP_IO_HUP) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(mp_module_uevloop_globals, mp_module_uevloop_globals_table);
+
+const mp_obj_module_t mp_module_uevloop = {
+    .base = { &mp_type_module },
+    .name = MP_QSTR_uevloop,
+    .globals = (mp_obj_dict_t*)&mp_module_uevloop_globals,
+};
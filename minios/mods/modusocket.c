@@ -10,13 +10,20 @@ STATIC const mp_map_elem_t socket_locals_dict_table[] = {
   { MP_OBJ_NEW_QSTR(MP_QSTR_bind),            (mp_obj_t)&lwip_socket_bind },
   { MP_OBJ_NEW_QSTR(MP_QSTR_listen),          (mp_obj_t)&lwip_socket_listen },
   { MP_OBJ_NEW_QSTR(MP_QSTR_accept),          (mp_obj_t)&lwip_socket_accept },
+  { MP_OBJ_NEW_QSTR(MP_QSTR_accept_many),     (mp_obj_t)&lwip_socket_accept_many },
   { MP_OBJ_NEW_QSTR(MP_QSTR_connect),         (mp_obj_t)&lwip_socket_connect },
   { MP_OBJ_NEW_QSTR(MP_QSTR_send),            (mp_obj_t)&lwip_socket_send },
   { MP_OBJ_NEW_QSTR(MP_QSTR_sendall),         (mp_obj_t)&lwip_socket_sendall },
   { MP_OBJ_NEW_QSTR(MP_QSTR_recv),            (mp_obj_t)&lwip_socket_recv },
   { MP_OBJ_NEW_QSTR(MP_QSTR_sendto),          (mp_obj_t)&lwip_socket_sendto },
   { MP_OBJ_NEW_QSTR(MP_QSTR_recvfrom),        (mp_obj_t)&lwip_socket_recvfrom },
+  { MP_OBJ_NEW_QSTR(MP_QSTR_recv_into),       (mp_obj_t)&lwip_socket_recv_into },
+  { MP_OBJ_NEW_QSTR(MP_QSTR_recvfrom_into),   (mp_obj_t)&lwip_socket_recvfrom_into },
+  { MP_OBJ_NEW_QSTR(MP_QSTR_recvfrom_many),   (mp_obj_t)&lwip_socket_recvfrom_many },
+  { MP_OBJ_NEW_QSTR(MP_QSTR_dropped),         (mp_obj_t)&lwip_socket_dropped },
+  { MP_OBJ_NEW_QSTR(MP_QSTR_sendmany),        (mp_obj_t)&lwip_socket_sendmany },
   { MP_OBJ_NEW_QSTR(MP_QSTR_setsockopt),      (mp_obj_t)&lwip_socket_setsockopt },
+  { MP_OBJ_NEW_QSTR(MP_QSTR_getsockopt),      (mp_obj_t)&lwip_socket_getsockopt },
   { MP_OBJ_NEW_QSTR(MP_QSTR_settimeout),      (mp_obj_t)&lwip_socket_settimeout },
   { MP_OBJ_NEW_QSTR(MP_QSTR_setblocking),     (mp_obj_t)&lwip_socket_setblocking },
   { MP_OBJ_NEW_QSTR(MP_QSTR_makefile),        (mp_obj_t)&lwip_socket_makefile },
@@ -54,6 +61,8 @@ STATIC const mp_map_elem_t mp_module_usocket_globals_table[] = {
   { MP_OBJ_NEW_QSTR(MP_QSTR_SOCK_STREAM),     MP_OBJ_NEW_SMALL_INT(SOCK_STREAM) },
   { MP_OBJ_NEW_QSTR(MP_QSTR_SOCK_DGRAM),      MP_OBJ_NEW_SMALL_INT(SOCK_DGRAM) },
   { MP_OBJ_NEW_QSTR(MP_QSTR_SO_REUSEADDR),      MP_OBJ_NEW_SMALL_INT(SO_REUSEADDR) },  
+  { MP_OBJ_NEW_QSTR(MP_QSTR_SO_RCVBUF),       MP_OBJ_NEW_SMALL_INT(SO_RCVBUF) },
+  { MP_OBJ_NEW_QSTR(MP_QSTR_SO_ERROR),        MP_OBJ_NEW_SMALL_INT(SO_ERROR) },
 
   { MP_OBJ_NEW_QSTR(MP_QSTR_IPPROTO_SEC),     MP_OBJ_NEW_SMALL_INT(SEC_SOCKET) },
   { MP_OBJ_NEW_QSTR(MP_QSTR_SOL_SOCKET),      MP_OBJ_NEW_SMALL_INT(SOL_SOCKET) },  
@@ -0,0 +1,289 @@
+# uasyncio for Minipython
+#
+# Follows the API of micropython-lib's uasyncio (get_event_loop(),
+# create_task(), sleep(), IORead/IOWrite, StreamReader/StreamWriter,
+# open_connection(), start_server()), but leaves the run queue, the
+# timer heap and socket readiness to the native event loop (uevloop),
+# which blocks the vCPU while there is nothing to do.
+
+import utime as time
+import usocket as socket
+import uevloop
+
+type_gen = type((lambda: (yield))())
+
+
+class CancelledError(Exception):
+    pass
+
+
+class SysCall:
+
+    def __init__(self, *args):
+        self.args = args
+
+
+class SysCall1(SysCall):
+
+    def __init__(self, arg):
+        self.arg = arg
+
+
+class StopLoop(SysCall1):
+    pass
+
+
+class SleepMs(SysCall1):
+    pass
+
+
+class IORead(SysCall1):
+    pass
+
+
+class IOWrite(SysCall1):
+    pass
+
+
+class IOReadDone(SysCall1):
+    pass
+
+
+class IOWriteDone(SysCall1):
+    pass
+
+
+class EventLoop:
+
+    def time(self):
+        return time.ticks_ms()
+
+    def create_task(self, coro):
+        uevloop.call_soon(coro)
+        return coro
+
+    def call_soon(self, callback, *args):
+        if isinstance(callback, type_gen):
+            uevloop.call_soon(callback)
+        else:
+            uevloop.call_soon((callback, args))
+
+    def call_later(self, delay, callback, *args):
+        self.call_later_ms(int(delay * 1000), callback, *args)
+
+    def call_later_ms(self, delay, callback, *args):
+        self.call_at(self.time() + delay, callback, *args)
+
+    def call_at(self, t, callback, *args):
+        if isinstance(callback, type_gen):
+            uevloop.call_at(t, callback)
+        else:
+            uevloop.call_at(t, (callback, args))
+
+    def run_forever(self):
+        while True:
+            cb = uevloop.next()
+            if cb is None:
+                # nothing queued, pending or waited for
+                return
+            if type(cb) is tuple:
+                cb[0](*cb[1])
+                continue
+            try:
+                ret = next(cb)
+            except (StopIteration, CancelledError):
+                continue
+            if isinstance(ret, SysCall1):
+                arg = ret.arg
+                if isinstance(ret, SleepMs):
+                    uevloop.call_at(self.time() + arg, cb)
+                    continue
+                elif isinstance(ret, IORead):
+                    uevloop.wait_io(arg, uevloop.POLLIN, cb)
+                    continue
+                elif isinstance(ret, IOWrite):
+                    uevloop.wait_io(arg, uevloop.POLLOUT, cb)
+                    continue
+                elif isinstance(ret, (IOReadDone, IOWriteDone)):
+                    # waiters are one-shot, just make sure none is left
+                    uevloop.remove_io(arg)
+                elif isinstance(ret, StopLoop):
+                    return arg
+            elif isinstance(ret, type_gen):
+                uevloop.call_soon(ret)
+            elif ret is False:
+                # the coroutine arranged to be rescheduled itself; tested
+                # before int, since bool is a subclass of it
+                continue
+            elif isinstance(ret, int):
+                uevloop.call_at(self.time() + ret, cb)
+                continue
+            uevloop.call_soon(cb)
+
+    def run_until_complete(self, coro):
+        def _run_and_stop():
+            yield from coro
+            yield StopLoop(0)
+        uevloop.call_soon(_run_and_stop())
+        self.run_forever()
+
+    def stop(self):
+        def _stop():
+            yield StopLoop(0)
+        uevloop.call_soon(_stop())
+
+    def close(self):
+        pass
+
+
+_event_loop = None
+
+
+def get_event_loop():
+    global _event_loop
+    if _event_loop is None:
+        _event_loop = EventLoop()
+    return _event_loop
+
+
+def sleep_ms(ms):
+    yield SleepMs(int(ms))
+
+
+def sleep(secs):
+    yield SleepMs(int(secs * 1000))
+
+
+# newlib errno values
+EAGAIN = 11
+ETIMEDOUT = 116
+EINPROGRESS = 119
+
+
+def _would_block(e):
+    return e.args[0] in (EAGAIN, ETIMEDOUT, EINPROGRESS)
+
+
+class StreamReader:
+
+    def __init__(self, sock):
+        self.s = sock
+        self.buf = b""
+
+    def read(self, n=-1):
+        if self.buf:
+            if n < 0 or n >= len(self.buf):
+                res, self.buf = self.buf, b""
+            else:
+                res, self.buf = self.buf[:n], self.buf[n:]
+            return res
+        yield IORead(self.s)
+        return self.s.recv(n if n > 0 else 1460)
+
+    def readinto(self, buf):
+        if self.buf:
+            n = min(len(buf), len(self.buf))
+            buf[:n] = self.buf[:n]
+            self.buf = self.buf[n:]
+            return n
+        yield IORead(self.s)
+        return self.s.recv_into(buf)
+
+    def readexactly(self, n):
+        res = b""
+        while len(res) < n:
+            data = yield from self.read(n - len(res))
+            if not data:
+                raise EOFError
+            res += data
+        return res
+
+    def readline(self):
+        while True:
+            i = self.buf.find(b"\n")
+            if i >= 0:
+                res, self.buf = self.buf[:i + 1], self.buf[i + 1:]
+                return res
+            yield IORead(self.s)
+            data = self.s.recv(1460)
+            if not data:
+                res, self.buf = self.buf, b""
+                return res
+            self.buf += data
+
+    def aclose(self):
+        yield IOReadDone(self.s)
+        self.s.close()
+
+    def __repr__(self):
+        return "<StreamReader %r>" % self.s
+
+
+class StreamWriter:
+
+    def __init__(self, sock, extra=None):
+        self.s = sock
+        self.extra = extra or {}
+
+    def awrite(self, buf, off=0, sz=-1):
+        if sz == -1:
+            sz = len(buf) - off
+        mv = memoryview(buf)
+        while sz:
+            try:
+                n = self.s.send(mv[off:off + sz])
+            except OSError as e:
+                if not _would_block(e):
+                    raise
+                n = 0
+            off += n
+            sz -= n
+            if sz:
+                yield IOWrite(self.s)
+
+    def awriteiter(self, iterable):
+        for line in iterable:
+            yield from self.awrite(line)
+
+    def aclose(self):
+        yield IOWriteDone(self.s)
+        self.s.close()
+
+    def get_extra_info(self, name, default=None):
+        return self.extra.get(name, default)
+
+    def __repr__(self):
+        return "<StreamWriter %r>" % self.s
+
+
+def open_connection(host, port):
+    ai = socket.getaddrinfo(host, port)[0]
+    s = socket.socket()
+    s.settimeout(0)
+    try:
+        s.connect(ai[-1])
+    except OSError as e:
+        # with a zero timeout, connect() returns right after sending SYN
+        if not _would_block(e):
+            raise
+        yield IOWrite(s)
+        # a failed connect also wakes up writers; its error is only
+        # reported through SO_ERROR
+        err = s.getsockopt(socket.SOL_SOCKET, socket.SO_ERROR)
+        if err:
+            s.close()
+            raise OSError(err)
+    return StreamReader(s), StreamWriter(s, {"peername": ai[-1]})
+
+
+def start_server(client_coro, host, port, backlog=10):
+    s = socket.socket()
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    s.bind((host, port))
+    s.listen(backlog)
+    s.settimeout(0)
+    while True:
+        yield IORead(s)
+        for s2, client_addr in s.accept_many(backlog):
+            s2.settimeout(0)
+            uevloop.call_soon(client_coro(StreamReader(s2), StreamWriter(s2, {"peername": client_addr})))
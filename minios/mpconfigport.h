@@ -99,9 +99,18 @@
 #define MICROPY_PY_IO_FILEIO        (0)
 #define MICROPY_PY_GC_COLLECT_RETVAL (1)
 #define MICROPY_MODULE_FROZEN_STR   (0)
+#define MICROPY_MODULE_FROZEN_MPY   (1)
+#define MICROPY_QSTR_EXTRA_POOL     (mp_qstr_frozen_const_pool)
 #define MICROPY_PY_LWIP             (0)
+// Stackless mode: Python calls allocate their frames on the GC heap
+// instead of recursing on the C stack (CONFIG_STACKLESS=y). Not strict:
+// when the heap is exhausted, a call falls back to the C stack.
+#ifndef MICROPY_STACKLESS
 #define MICROPY_STACKLESS           (0)
+#endif
+#ifndef MICROPY_STACKLESS_STRICT
 #define MICROPY_STACKLESS_STRICT    (0)
+#endif
 
 #define MICROPY_PY_USSL (0)
 #define MICROPY_PY_WEBSOCKET (1)
@@ -137,6 +146,164 @@
 #define MICROPY_VFS_FAT                (1)
 #endif
 
+// Cache compiled scripts as .mpy files on the FAT volume, keyed by their
+// path, length and modification time, so that later boots skip reading,
+// parsing and compiling them (see mpycache.c)
+#ifndef MICROPY_MPY_CACHE
+#define MICROPY_MPY_CACHE              (MICROPY_VFS_FAT)
+#endif
+#define MICROPY_MPY_CACHE_DIR          "__pycache__"
+#if MICROPY_MPY_CACHE
+#define MICROPY_PERSISTENT_CODE_SAVE   (1)
+#endif
+
+// Cache results of mp_import_stat() (see importcache.c)
+#ifndef MICROPY_IMPORT_STAT_CACHE
+#define MICROPY_IMPORT_STAT_CACHE      (MICROPY_VFS_FAT)
+#endif
+#define MICROPY_IMPORT_STAT_CACHE_SIZE (1024)
+
+// Boot from a snapshot of a warmed-up interpreter (see snapshot.c).
+// The snapshot lives on its own block device (default: xvdb); it is
+// created on the first boot after running MICROPY_SNAPSHOT_WARMUP.
+#ifndef MICROPY_HEAP_SNAPSHOT
+#define MICROPY_HEAP_SNAPSHOT          (0)
+#endif
+#ifndef MICROPY_SNAPSHOT_BLKDEV
+#define MICROPY_SNAPSHOT_BLKDEV        (51728)
+#endif
+#ifndef MICROPY_SNAPSHOT_WARMUP
+#define MICROPY_SNAPSHOT_WARMUP        "warmup.py"
+#endif
+
+// Idle-time GC: run a full (stop-the-world) collection at idle points
+// once this share of the heap (in percent) is used; 0 disables it (see
+// gccollect.c). This is not incremental collection: a collection forced
+// by a failed allocation still pauses the request for the whole heap.
+#ifndef MICROPY_GC_IDLE_PERCENT
+#define MICROPY_GC_IDLE_PERCENT        (50)
+#endif
+
+// Record pause time, reclaimed and live bytes of every collection
+// (see gccollect.c, minipython.gc_stats())
+#ifndef MICROPY_GC_STATS
+#define MICROPY_GC_STATS               (1)
+#endif
+
+// Sampling allocation profiler, needs the build flags set by
+// CONFIG_ALLOC_PROFILE in the Makefile (see allocprof.c)
+#ifndef MICROPY_ALLOC_PROFILE
+#define MICROPY_ALLOC_PROFILE          (0)
+#endif
+
+// Sampling bytecode profiler, driven by the VM hooks (see vmprof.c)
+#ifndef MICROPY_VM_PROFILE
+#define MICROPY_VM_PROFILE             (0)
+#endif
+#if MICROPY_ALLOC_PROFILE && MICROPY_STACKLESS
+struct _mp_code_state;
+void allocprof_enter(const struct _mp_code_state *code_state);
+#define ALLOCPROF_HOOK_INIT(code_state) allocprof_enter(code_state);
+#else
+#define ALLOCPROF_HOOK_INIT(code_state)
+#endif
+
+// The VM hooks are only installed for the profilers. Timer services of
+// the event loop run from polls, sleeps and blocking calls instead (see
+// evloop.c), never from within bytecode
+#if MICROPY_VM_PROFILE
+struct _mp_code_state;
+void vmprof_hook(const struct _mp_code_state *code_state);
+#define MICROPY_VM_HOOK_COUNT (64)
+#define MICROPY_VM_HOOK_INIT static uint vm_hook_divisor = MICROPY_VM_HOOK_COUNT; \
+        ALLOCPROF_HOOK_INIT(code_state)
+#define MICROPY_VM_HOOK_POLL if (--vm_hook_divisor == 0) { \
+        vm_hook_divisor = MICROPY_VM_HOOK_COUNT; \
+        vmprof_hook(code_state); \
+    }
+#define MICROPY_VM_HOOK_LOOP MICROPY_VM_HOOK_POLL
+#define MICROPY_VM_HOOK_RETURN MICROPY_VM_HOOK_POLL
+#elif MICROPY_ALLOC_PROFILE && MICROPY_STACKLESS
+#define MICROPY_VM_HOOK_INIT ALLOCPROF_HOOK_INIT(code_state)
+#endif
+
+// Executable arena for native code (see alloc.c)
+#ifndef MICROPY_EXEC_ARENA_SIZE
+#define MICROPY_EXEC_ARENA_SIZE        (1024 * 1024)
+#endif
+
+// Recompile scripts that were run more than MICROPY_TIER_THRESHOLD
+// times with the native emitter (see do_file() in minipython.c).
+// Native code does not run the VM hooks: while promoted code runs
+// without calling back into bytecode or waiting (sleep, socket calls),
+// the profilers and pending exceptions (e.g., Ctrl-C) wait.
+// Hence off by default, enabled with CONFIG_TIERING in the Makefile.
+#ifndef MICROPY_TIERING
+#define MICROPY_TIERING                (0)
+#endif
+#ifndef MICROPY_TIER_THRESHOLD
+#define MICROPY_TIER_THRESHOLD         (2)
+#endif
+
+// Run all scripts listed in MICROPY_JOB_MANIFEST in one interpreter
+// instead of a single script (see jobrunner.c)
+#ifndef MICROPY_JOB_RUNNER
+#define MICROPY_JOB_RUNNER             (0)
+#endif
+#ifndef MICROPY_JOB_MANIFEST
+#define MICROPY_JOB_MANIFEST           "jobs.txt"
+#endif
+
+// Longest time the event loop sleeps between two polls of
+// its sources (netfront, blkfront), in ms (see evloop.c)
+#ifndef MICROPY_EVLOOP_MAX_BLOCK_MS
+#define MICROPY_EVLOOP_MAX_BLOCK_MS    (100)
+#endif
+// Longest sleep while a source is registered whose front-end does not
+// wake up its wait queue (see evloop_add_source())
+#ifndef MICROPY_EVLOOP_SLICE_MS
+#define MICROPY_EVLOOP_SLICE_MS        (2)
+#endif
+#define MICROPY_EVLOOP_MAX_SOURCES     (8)
+
+// Busy waits of the core (e.g., uselect.poll()) drive the event sources
+void evloop_poll(void);
+#define MICROPY_EVENT_POLL_HOOK evloop_poll();
+
+// Number of pbuf chains a TCP socket queues for reading (see
+// _lwip_tcp_recv()); the queued bytes are bounded by TCP_WND, further
+// segments are chained to the last one
+#ifndef MICROPY_PY_LWIP_TCP_RECV_QUEUE
+#define MICROPY_PY_LWIP_TCP_RECV_QUEUE (32)
+#endif
+
+// Upper bound of the listen() backlog: connections that complete the
+// handshake while that many are already waiting for accept() are reset
+#ifndef MICROPY_PY_LWIP_LISTEN_BACKLOG_MAX
+#define MICROPY_PY_LWIP_LISTEN_BACKLOG_MAX (64)
+#endif
+
+// Number of datagrams a UDP socket queues for reading, and the default
+// bound of their payload in bytes (SO_RCVBUF); datagrams that do not fit
+// are dropped and counted (see _lwip_udp_incoming())
+#ifndef MICROPY_PY_LWIP_UDP_RECV_QUEUE
+#define MICROPY_PY_LWIP_UDP_RECV_QUEUE (64)
+#endif
+#ifndef MICROPY_PY_LWIP_UDP_RCVBUF
+#define MICROPY_PY_LWIP_UDP_RCVBUF     (64 * 1024)
+#endif
+
+// TCP sends of bytes or read-only memoryviews of at least this many bytes
+// pass the buffer to lwIP without copying (see lwip_pin()); UDP sends of
+// any buffer that large use a referencing pbuf if
+// MICROPY_PY_LWIP_UDP_ZEROCOPY is set (by CONFIG_NETFRONT_PERSISTENT_GRANTS)
+#ifndef MICROPY_PY_LWIP_ZEROCOPY_MIN
+#define MICROPY_PY_LWIP_ZEROCOPY_MIN   (512)
+#endif
+#ifndef MICROPY_PY_LWIP_UDP_ZEROCOPY
+#define MICROPY_PY_LWIP_UDP_ZEROCOPY   (0)
+#endif
+
 // Define to MICROPY_ERROR_REPORTING_DETAILED to get function, etc.
 // names in exception messages (may require more RAM).
 #define MICROPY_ERROR_REPORTING     (MICROPY_ERROR_REPORTING_DETAILED)
@@ -166,11 +333,15 @@ extern const struct _mp_obj_module_t mp_module_time;
 extern const struct _mp_obj_module_t mp_module_usocket;
 extern const struct _mp_obj_module_t mp_module_os;
 extern const struct _mp_obj_module_t mp_module_lwip;
+extern const struct _mp_obj_module_t mp_module_minipython;
+extern const struct _mp_obj_module_t mp_module_uevloop;
 #define MICROPY_PORT_BUILTIN_MODULES \
   { MP_OBJ_NEW_QSTR(MP_QSTR_usocket), (mp_obj_t)&mp_module_usocket }, \
   { MP_ROM_QSTR(MP_QSTR_utime), MP_ROM_PTR(&mp_module_time) }, \
   { MP_ROM_QSTR(MP_QSTR_uos), MP_ROM_PTR(&mp_module_os) }, \
   { MP_ROM_QSTR(MP_QSTR_lwip), MP_ROM_PTR(&mp_module_lwip) }, \
+  { MP_ROM_QSTR(MP_QSTR_minipython), MP_ROM_PTR(&mp_module_minipython) }, \
+  { MP_ROM_QSTR(MP_QSTR_uevloop), MP_ROM_PTR(&mp_module_uevloop) }, \
 
 // type definitions for the specific machine
 // assume that if we already defined the obj repr then we also defined types
@@ -232,7 +403,11 @@ typedef const void *machine_const_ptr_t; // must be of pointer size
 #define MICROPY_PORT_ROOT_POINTERS \
     const char *readline_hist[50]; \
     mp_obj_t keyboard_interrupt_obj; \
-    void *mmap_region_head; \
+    mp_obj_t tier_dict; \
+    mp_obj_t *evloop_runq; \
+    struct _evloop_timer_t *evloop_timers; \
+    struct _evloop_io_t *evloop_io; \
+    struct _lwip_socket_obj_t *lwip_pinned; \
 
 // We need to provide a declaration/definition of alloca()
 // unless support for it is disabled.
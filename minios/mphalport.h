@@ -34,7 +34,15 @@ void mp_hal_set_interrupt_char(char c);
 void mp_hal_stdio_mode_raw(void);
 void mp_hal_stdio_mode_orig(void);
 
-static inline void mp_hal_delay_ms(mp_uint_t ms) { usleep((ms) * 1000); }
+#if MICROPY_ENABLE_GC
+void gc_collect_idle(void);
+#else
+static inline void gc_collect_idle(void) {}
+#endif
+
+// Sleeps go through the event loop, which services the drivers' timers
+void evloop_delay_ms(mp_uint_t ms);
+static inline void mp_hal_delay_ms(mp_uint_t ms) { evloop_delay_ms(ms); }
 
 #define RAISE_ERRNO(err_flag, error_val) \
     { if (err_flag == -1) \
@@ -0,0 +1,361 @@
+/*
+ * Minipython, a Xen-based Unikernel.
+ *
+ * Authors:  Felipe Huici <felipe.huici@neclab.eu>
+ *           Simon Kuenzer <simon.kuenzer@neclab.eu>
+ *
+ *
+ * Copyright (c) 2013-2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "minipython.h"
+
+#if MICROPY_VFS_FAT
+
+#include "py/persistentcode.h"
+#include "py/emitglue.h"
+
+/* Compiled bytecode cache
+ *
+ * The hash of the path of a script names a .mpy file in
+ * MICROPY_MPY_CACHE_DIR on the FAT volume. Its header records the path,
+ * length and FNV-1a hash of the source it was compiled from. The source
+ * is read and hashed on every load (FAT modification times, with their
+ * 2 s steps, cannot tell a quick rewrite of the same length); if all
+ * three match, the bytecode is loaded from the cache and lexing,
+ * parsing and compiling are skipped. Otherwise the source is compiled
+ * as usual and the result is written back to the cache for next time.
+ *
+ * Scripts run with do_file() and imported modules are cached alike. For
+ * a module whose source foo.py exists, mp_import_stat() reports foo.py
+ * as absent and foo.mpy as present, so builtinimport.c loads it with
+ * mp_raw_code_load_file(). py/persistentcode.o is built with its own
+ * version of that function renamed (see the Makefile); the one below
+ * maps foo.mpy back to foo.py and goes through the cache. As with any
+ * .mpy module, __file__ is not set for these modules. The __init__.py
+ * of a package is not cached, since the core only looks for that name. */
+
+#define MPYCACHE_MAGIC  (0x4d46) /* "MF" */
+#define MPYCACHE_EOF    ((mp_uint_t)-1)
+
+typedef struct _mpycache_reader_t {
+  FIL fp;
+  bool open;
+  UINT len;
+  UINT pos;
+  byte buf[64];
+} mpycache_reader_t;
+
+STATIC mp_uint_t mpycache_read_byte(void *data) {
+  mpycache_reader_t *r = data;
+
+  if (r->pos >= r->len) {
+    if (f_read(&r->fp, r->buf, sizeof(r->buf), &r->len) != FR_OK || r->len == 0) {
+      r->len = 0;
+      return MPYCACHE_EOF;
+    }
+    r->pos = 0;
+  }
+  return r->buf[r->pos++];
+}
+
+STATIC void mpycache_reader_close(void *data) {
+  mpycache_reader_t *r = data;
+
+  if (r->open) {
+    f_close(&r->fp);
+    r->open = false;
+  }
+}
+
+#if MICROPY_MPY_CACHE
+
+typedef struct _mpycache_hdr_t {
+  uint16_t magic;
+  uint16_t emit_opt;
+  uint32_t src_len;
+  uint32_t src_hash; /* FNV-1a of the source */
+  uint32_t path_len; /* followed by the path of the source */
+} mpycache_hdr_t;
+
+/* What a cache entry has to match */
+typedef struct _mpycache_key_t {
+  const char *path;
+  uint32_t path_hash;
+  uint32_t src_len;
+  uint32_t src_hash;
+} mpycache_key_t;
+
+/* 32-bit FNV-1a */
+STATIC uint32_t mpycache_hash(const byte *data, size_t len) {
+  uint32_t h = 2166136261u;
+
+  while (len--) {
+    h ^= *data++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+STATIC void mpycache_path(char *out, size_t outlen, uint32_t hash, const char *ext) {
+  snprintf(out, outlen, "%s/%08lx.%s", MICROPY_MPY_CACHE_DIR, (unsigned long) hash, ext);
+}
+
+/* Returns true if the header (and the path after it) read from r
+ * describes the source of key */
+STATIC bool mpycache_check_hdr(mpycache_reader_t *r, const mpycache_key_t *key, uint emit_opt) {
+  char src_path[MICROPY_ALLOC_PATH_MAX];
+  mpycache_hdr_t hdr;
+  UINT n;
+
+  if (f_read(&r->fp, &hdr, sizeof(hdr), &n) != FR_OK || n != sizeof(hdr) ||
+      hdr.magic != MPYCACHE_MAGIC || hdr.emit_opt != emit_opt ||
+      hdr.src_len != key->src_len ||
+      hdr.src_hash != key->src_hash || hdr.path_len != strlen(key->path) ||
+      hdr.path_len >= sizeof(src_path)) {
+    return false;
+  }
+  if (f_read(&r->fp, src_path, hdr.path_len, &n) != FR_OK || n != hdr.path_len) {
+    return false;
+  }
+  return memcmp(src_path, key->path, hdr.path_len) == 0;
+}
+
+/* Returns the cached raw code for a source, or NULL on a cache miss or
+ * if the cached file is stale or unreadable */
+STATIC mp_raw_code_t *mpycache_read(const mpycache_key_t *key, uint emit_opt) {
+  char path[MICROPY_ALLOC_PATH_MAX];
+  mpycache_reader_t *r;
+  mp_raw_code_t *rc = NULL;
+
+  mpycache_path(path, sizeof(path), key->path_hash, "mpy");
+  r = m_new_obj(mpycache_reader_t);
+  if (f_open(&r->fp, path, FA_READ) != FR_OK) {
+    m_del_obj(mpycache_reader_t, r);
+    return NULL;
+  }
+  r->open = true;
+  r->len = 0;
+  r->pos = 0;
+
+  if (!mpycache_check_hdr(r, key, emit_opt)) {
+    goto out;
+  }
+
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    mp_reader_t reader = { r, mpycache_read_byte, mpycache_reader_close };
+    rc = mp_raw_code_load(&reader);
+    nlr_pop();
+  } else {
+    /* incompatible or truncated .mpy: recompile */
+    rc = NULL;
+  }
+
+ out:
+  mpycache_reader_close(r);
+  m_del_obj(mpycache_reader_t, r);
+  return rc;
+}
+
+STATIC void mpycache_print_strn(void *env, const char *str, size_t len) {
+  UINT n;
+  f_write((FIL *) env, str, len, &n);
+}
+
+/* Stores raw code in the cache. Written to a temporary file first so
+ * that an interrupted boot never leaves a truncated entry behind.
+ * Failures are silently ignored: the cache is an optimization only. */
+STATIC void mpycache_write(mp_raw_code_t *rc, const mpycache_key_t *key, uint emit_opt) {
+  char path[MICROPY_ALLOC_PATH_MAX];
+  char tmp_path[MICROPY_ALLOC_PATH_MAX];
+  mpycache_hdr_t hdr;
+  FIL *fp;
+  UINT n, m;
+  bool ok = false;
+
+  mpycache_path(path, sizeof(path), key->path_hash, "mpy");
+  mpycache_path(tmp_path, sizeof(tmp_path), key->path_hash, "tmp");
+
+  f_mkdir(MICROPY_MPY_CACHE_DIR);
+  fp = m_new_obj(FIL);
+  if (f_open(fp, tmp_path, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+    m_del_obj(FIL, fp);
+    return;
+  }
+
+  hdr.magic = MPYCACHE_MAGIC;
+  hdr.emit_opt = emit_opt;
+  hdr.src_len = key->src_len;
+  hdr.src_hash = key->src_hash;
+  hdr.path_len = strlen(key->path);
+  if (f_write(fp, &hdr, sizeof(hdr), &n) == FR_OK && n == sizeof(hdr) &&
+      f_write(fp, key->path, hdr.path_len, &m) == FR_OK && m == hdr.path_len) {
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+      /* raises for code that cannot be saved, e.g., native functions */
+      mp_print_t print = { fp, mpycache_print_strn };
+      mp_raw_code_save(rc, &print);
+      nlr_pop();
+      ok = true;
+    }
+  }
+
+  ok = (f_close(fp) == FR_OK) && ok;
+  m_del_obj(FIL, fp);
+  if (ok) {
+    f_unlink(path);
+    ok = (f_rename(tmp_path, path) == FR_OK);
+  }
+  if (!ok)
+    f_unlink(tmp_path);
+}
+
+/* Returns the raw code for a source file, taking it from the cache
+ * when possible. Raises OSError if the file cannot be read and any
+ * exception the compiler raises. */
+STATIC mp_raw_code_t *mpycache_load_raw_code(const char *filename, uint emit_opt) {
+  mpycache_key_t key;
+  mp_raw_code_t *rc;
+  mp_lexer_t *lex;
+  qstr source_name;
+  size_t len;
+  byte *src;
+  FIL fp;
+  UINT n;
+
+  if (f_open(&fp, filename, FA_READ) != FR_OK) {
+    nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(ENOENT)));
+  }
+  len = f_size(&fp);
+  src = m_new_maybe(byte, len);
+  if (src == NULL) {
+    f_close(&fp);
+    nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(ENOMEM)));
+  }
+  if (f_read(&fp, src, len, &n) != FR_OK || n != len) {
+    f_close(&fp);
+    m_del(byte, src, len);
+    nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(EIO)));
+  }
+  f_close(&fp);
+
+  key.path = filename;
+  key.path_hash = mpycache_hash((const byte *) filename, strlen(filename));
+  key.src_len = len;
+  key.src_hash = mpycache_hash(src, len);
+  rc = mpycache_read(&key, emit_opt);
+  if (rc != NULL) {
+    m_del(byte, src, len);
+    return rc;
+  }
+
+  /* cache miss: compile the source */
+  /* the lexer takes ownership of src */
+  source_name = qstr_from_str(filename);
+  lex = mp_lexer_new_from_str_len(source_name, (const char *) src, len, len);
+  if (lex == NULL) {
+    nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(ENOMEM)));
+  }
+  mp_parse_tree_t parse_tree = mp_parse(lex, MP_PARSE_FILE_INPUT);
+  rc = mp_compile_to_raw_code(&parse_tree, source_name, emit_opt, false);
+  mpycache_write(rc, &key, emit_opt);
+  return rc;
+}
+
+/* Returns the module function for a script, see mpycache_load_raw_code() */
+mp_obj_t mpycache_load_file(const char *filename, uint emit_opt) {
+  mp_raw_code_t *rc = mpycache_load_raw_code(filename, emit_opt);
+  return mp_make_function_from_raw_code(rc, MP_OBJ_NULL, MP_OBJ_NULL);
+}
+
+/* Writes the source path foo.py of a module path foo.mpy to src.
+ * Returns false if path does not name a .mpy file or src is too small. */
+bool mpycache_source_path(const char *path, char *src, size_t srclen) {
+  size_t len = strlen(path);
+
+  if (len < 4 || strcmp(path + len - 4, ".mpy") != 0 || len > srclen) {
+    return false;
+  }
+  memcpy(src, path, len - 3);
+  strcpy(src + len - 3, "py");
+  return true;
+}
+
+#endif // MICROPY_MPY_CACHE
+
+/* Loads a .mpy module for builtinimport.c through FatFs; the version
+ * in py/persistentcode.c reads with POSIX open(), which cannot reach
+ * the FAT volume. Modules with a source are taken from the cache
+ * (compiled as mp_import does, without emit options); other .mpy files
+ * are read from the volume as they are. */
+mp_raw_code_t *mp_raw_code_load_file(const char *filename) {
+#if MICROPY_MPY_CACHE
+  char src[MICROPY_ALLOC_PATH_MAX];
+  FILINFO fno;
+#endif
+  mpycache_reader_t *r;
+  mp_raw_code_t *rc;
+
+#if MICROPY_MPY_CACHE
+#if _USE_LFN
+  fno.lfname = NULL;
+  fno.lfsize = 0;
+#endif
+  if (mpycache_source_path(filename, src, sizeof(src)) &&
+      f_stat(src, &fno) == FR_OK && !(fno.fattrib & AM_DIR)) {
+    return mpycache_load_raw_code(src, MP_EMIT_OPT_NONE);
+  }
+#endif
+
+  r = m_new_obj(mpycache_reader_t);
+  if (f_open(&r->fp, filename, FA_READ) != FR_OK) {
+    m_del_obj(mpycache_reader_t, r);
+    nlr_raise(mp_obj_new_exception_arg1(&mp_type_OSError, MP_OBJ_NEW_SMALL_INT(ENOENT)));
+  }
+  r->open = true;
+  r->len = 0;
+  r->pos = 0;
+
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    mp_reader_t reader = { r, mpycache_read_byte, mpycache_reader_close };
+    rc = mp_raw_code_load(&reader);
+    nlr_pop();
+  } else {
+    mpycache_reader_close(r);
+    m_del_obj(mpycache_reader_t, r);
+    nlr_jump(nlr.ret_val);
+  }
+  mpycache_reader_close(r);
+  m_del_obj(mpycache_reader_t, r);
+  return rc;
+}
+
+#endif // MICROPY_VFS_FAT
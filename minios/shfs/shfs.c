@@ -64,6 +64,7 @@ typedef struct semaphore sem_t;
 #define ENABLE_DEBUG
 #endif
 #include "debug.h"
+#include "bootprof.h"
 
 #ifndef CACHELINE_SIZE
 #define CACHELINE_SIZE 64
@@ -574,6 +575,7 @@ int mount_shfs(blkdev_id_t bd_id[], unsigned int count)
 	ret = load_vol_cconf(bd_id, count);
 	if (ret < 0)
 		goto err_out;
+	bootprof_mark("shfs_cconf");
 
 	/* a memory pool required for async I/O requests (even on cache) */
 	shfs_vol.aiotoken_pool = alloc_mempool(NB_AIOTOKEN, sizeof(struct _shfs_aio_token),
@@ -587,6 +589,7 @@ int mount_shfs(blkdev_id_t bd_id[], unsigned int count)
 	ret = load_vol_hconf();
 	if (ret < 0)
 		goto err_free_aiotoken_pool;
+	bootprof_mark("shfs_hconf");
 
 	/* load htable (uses shfs_sync_read_chunk)
 	 * This function also allocates htable_chunk_cache,
@@ -595,6 +598,7 @@ int mount_shfs(blkdev_id_t bd_id[], unsigned int count)
 	ret = load_vol_htable();
 	if (ret < 0)
 		goto err_close_members;
+	bootprof_mark("shfs_htable");
 
 	printd("Allocating remount chunk buffer...\n");
 	shfs_vol.remount_chunk_buffer = target_malloc(shfs_vol.ioalign, shfs_vol.chunksize);
@@ -0,0 +1,311 @@
+/*
+ * Minipython, a Xen-based Unikernel.
+ *
+ * Authors:  Felipe Huici <felipe.huici@neclab.eu>
+ *           Simon Kuenzer <simon.kuenzer@neclab.eu>
+ *
+ *
+ * Copyright (c) 2013-2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "minipython.h"
+
+#if MICROPY_HEAP_SNAPSHOT
+
+#include "blkdev.h"
+
+/* Interpreter snapshots
+ *
+ * After a warm-up script has run, the interpreter state (mp_state_ctx,
+ * which holds the root pointers, loaded modules and the qstr pool
+ * chain) and the used part of the GC heap are written to a dedicated
+ * block device. Later boots of the same image read them back and skip
+ * gc_init(), mp_init() and the warm-up imports.
+ *
+ * The image stores raw pointers into the heap, .text, .rodata and .data,
+ * so it is only valid for the exact binary that wrote it and for a heap
+ * located at the same address (that is why the heap is a static area in
+ * this mode). The header carries a checksum of the text and read-only
+ * data of the image, computed at boot, which rejects images written by
+ * any other link of the program.
+ *
+ * Only the GC heap and mp_state_ctx are captured. The warm-up script
+ * must not leave state behind elsewhere; a snapshot is refused when
+ *  - native code was emitted (it lives in the exec arena of alloc.c),
+ *  - a network interface or socket was set up (netfront rings and lwIP
+ *    pcbs are malloc'ed).
+ * C-side caches (e.g., import lookups in importcache.c) are simply empty
+ * after a restore and fill up again. Other C state that warm-up code
+ * might create, e.g., event loop sources registered by a driver, is lost
+ * as well: warm-up scripts should only import and initialize Python
+ * modules.
+ *
+ * Device layout (page granular):
+ *   page 0     header; written last, so a torn write leaves no image
+ *   page 1..   mp_state_ctx
+ *   ...        used prefix of the heap area
+ */
+
+#define SNAPSHOT_MAGIC    (0x4d505953) /* "MPYS" */
+#define SNAPSHOT_VERSION  (2)
+#define SNAPSHOT_BUILD_ID MICROPY_GIT_HASH
+
+#define SNAPSHOT_STATE_LEN \
+  (((sizeof(mp_state_ctx) + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE)
+
+struct snapshot_hdr {
+  uint32_t magic;
+  uint32_t version;
+  char build_id[64];
+  uint64_t image_sum; /* of .text and .rodata */
+  uint64_t state_addr;
+  uint64_t state_len;
+  uint64_t heap_addr;
+  uint64_t heap_len;
+  uint64_t heap_used; /* bytes of the heap area stored in the image */
+};
+
+struct snapshot_io {
+  unsigned int pending;
+  int ret;
+};
+
+STATIC void snapshot_io_cb(int ret, void *argp) {
+  struct snapshot_io *io = argp;
+
+  if (ret < 0)
+    io->ret = ret;
+  --io->pending;
+}
+
+/* Transfers a page-aligned region from/to the device. The region is
+ * split into the largest requests blkfront accepts, all of them are
+ * queued at once and then waited for, so the device sees one
+ * sequential stream. */
+STATIC int snapshot_io(struct blkdev *bd, uint64_t offset, void *buf, uint64_t len, int write) {
+  struct snapshot_io io = { 0, 0 };
+  sector_t ssize = blkdev_ssize(bd);
+  sector_t max_sectors = (BLKIF_MAX_SEGMENTS_PER_REQUEST * PAGE_SIZE) / ssize;
+  sector_t start = offset / ssize;
+  sector_t left = len / ssize;
+  uint8_t *p = buf;
+  sector_t n;
+  int ret;
+
+  while (left) {
+    n = min(left, max_sectors);
+    ret = blkdev_async_io(bd, start, n, write, p, snapshot_io_cb, &io);
+    if (ret == -EAGAIN) {
+      /* request pool exhausted: let some requests complete */
+      blkdev_async_io_submit(bd);
+      blkdev_poll_req(bd);
+      schedule();
+      continue;
+    }
+    if (ret < 0) {
+      io.ret = ret;
+      break;
+    }
+    ++io.pending;
+    start += n;
+    left -= n;
+    p += n * ssize;
+  }
+  blkdev_async_io_submit(bd);
+
+  while (io.pending) {
+    blkdev_poll_req(bd);
+    if (io.pending)
+      schedule();
+  }
+  return io.ret;
+}
+
+/* Size of the heap area prefix that holds all allocated blocks
+ * (including the allocation and finaliser tables in front of the pool) */
+STATIC uint64_t snapshot_heap_used(char *heap, size_t heap_len) {
+  const byte *atb = MP_STATE_MEM(gc_alloc_table_start);
+  size_t i = MP_STATE_MEM(gc_alloc_table_byte_len);
+  uint64_t used;
+
+  while (i > 0 && atb[i - 1] == 0)
+    --i;
+  /* every ATB byte describes 4 blocks */
+  used = ((uintptr_t) MP_STATE_MEM(gc_pool_start) - (uintptr_t) heap)
+         + (uint64_t) i * 4 * MICROPY_BYTES_PER_GC_BLOCK;
+  used = ((used + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+  return min(used, (uint64_t) heap_len);
+}
+
+/* FNV-1a over the words of text and read-only data (bounds from the
+ * Mini-OS linker script); a few hundred microseconds for a typical image */
+STATIC uint64_t snapshot_image_sum(void) {
+  extern char _text, _erodata;
+  const uint64_t *p = (const uint64_t *) &_text;
+  const uint64_t *end = (const uint64_t *) ((uintptr_t) &_erodata & ~(uintptr_t) 7);
+  uint64_t h = 14695981039346656037ULL;
+
+  while (p < end)
+    h = (h ^ *p++) * 1099511628211ULL;
+  return h ^ (uint64_t) ((uintptr_t) &_erodata - (uintptr_t) &_text);
+}
+
+STATIC void snapshot_fill_hdr(struct snapshot_hdr *hdr, char *heap, size_t heap_len) {
+  memset(hdr, 0, sizeof(*hdr));
+  hdr->magic = SNAPSHOT_MAGIC;
+  hdr->version = SNAPSHOT_VERSION;
+  strncpy(hdr->build_id, SNAPSHOT_BUILD_ID, sizeof(hdr->build_id) - 1);
+  hdr->image_sum = snapshot_image_sum();
+  hdr->state_addr = (uintptr_t) &mp_state_ctx;
+  hdr->state_len = sizeof(mp_state_ctx);
+  hdr->heap_addr = (uintptr_t) heap;
+  hdr->heap_len = heap_len;
+}
+
+/* Restores interpreter state and heap from the snapshot device.
+ * Returns 0 on success, or a negative errno if there is no usable
+ * image; in that case the caller has to initialize the VM as usual. */
+int snapshot_restore(char *heap, size_t heap_len) {
+  struct snapshot_hdr expect;
+  struct snapshot_hdr *hdr;
+  struct blkdev *bd;
+  void *buf;
+  int ret;
+
+  bd = open_blkdev(MICROPY_SNAPSHOT_BLKDEV, O_RDONLY);
+  if (!bd)
+    return -ENODEV;
+  if (PAGE_SIZE % blkdev_ssize(bd)) {
+    ret = -EINVAL;
+    goto out_close;
+  }
+
+  buf = _xmalloc(PAGE_SIZE + SNAPSHOT_STATE_LEN, PAGE_SIZE);
+  if (!buf) {
+    ret = -ENOMEM;
+    goto out_close;
+  }
+
+  /* header and state first, they tell how much heap follows */
+  ret = snapshot_io(bd, 0, buf, PAGE_SIZE + SNAPSHOT_STATE_LEN, 0);
+  if (ret < 0)
+    goto out_free;
+
+  hdr = buf;
+  snapshot_fill_hdr(&expect, heap, heap_len);
+  if (hdr->magic != expect.magic ||
+      hdr->version != expect.version ||
+      strncmp(hdr->build_id, expect.build_id, sizeof(hdr->build_id)) != 0 ||
+      hdr->image_sum != expect.image_sum ||
+      hdr->state_addr != expect.state_addr ||
+      hdr->state_len != expect.state_len ||
+      hdr->heap_addr != expect.heap_addr ||
+      hdr->heap_len != expect.heap_len ||
+      hdr->heap_used > heap_len ||
+      hdr->heap_used % PAGE_SIZE) {
+    ret = -EINVAL;
+    goto out_free;
+  }
+
+  /* the heap area is page aligned, so data is read in place */
+  ret = snapshot_io(bd, PAGE_SIZE + SNAPSHOT_STATE_LEN, heap, hdr->heap_used, 0);
+  if (ret < 0)
+    goto out_free;
+
+  memcpy(&mp_state_ctx, (uint8_t *) buf + PAGE_SIZE, sizeof(mp_state_ctx));
+  ret = 0;
+
+ out_free:
+  xfree(buf);
+ out_close:
+  close_blkdev(bd);
+  return ret;
+}
+
+/* Writes the current interpreter state and heap to the snapshot device.
+ * Must be called outside of any Python execution (no active nlr
+ * frames). Returns 0 on success, a negative errno otherwise. */
+int snapshot_save(char *heap, size_t heap_len) {
+  struct snapshot_hdr *hdr;
+  struct blkdev *bd;
+  uint64_t heap_used;
+  void *buf;
+  int ret;
+
+  #if MICROPY_EMIT_NATIVE
+  if (mp_unix_exec_in_use())
+    return -EBUSY; /* native code is not part of the heap */
+  #endif
+  if (lwip_in_use())
+    return -EBUSY; /* neither are netfront and lwIP */
+
+  gc_collect();
+  heap_used = snapshot_heap_used(heap, heap_len);
+
+  bd = open_blkdev(MICROPY_SNAPSHOT_BLKDEV, O_RDWR);
+  if (!bd)
+    return -ENODEV;
+  if (blkdev_size(bd) < PAGE_SIZE + SNAPSHOT_STATE_LEN + heap_used ||
+      PAGE_SIZE % blkdev_ssize(bd)) {
+    ret = -ENOSPC;
+    goto out_close;
+  }
+
+  buf = _xmalloc(PAGE_SIZE + SNAPSHOT_STATE_LEN, PAGE_SIZE);
+  if (!buf) {
+    ret = -ENOMEM;
+    goto out_close;
+  }
+  memset(buf, 0, PAGE_SIZE + SNAPSHOT_STATE_LEN);
+  memcpy((uint8_t *) buf + PAGE_SIZE, &mp_state_ctx, sizeof(mp_state_ctx));
+
+  /* invalidate any previous image before overwriting it */
+  ret = snapshot_io(bd, 0, buf, PAGE_SIZE, 1);
+  if (ret < 0)
+    goto out_free;
+  ret = snapshot_io(bd, PAGE_SIZE, (uint8_t *) buf + PAGE_SIZE, SNAPSHOT_STATE_LEN, 1);
+  if (ret < 0)
+    goto out_free;
+  ret = snapshot_io(bd, PAGE_SIZE + SNAPSHOT_STATE_LEN, heap, heap_used, 1);
+  if (ret < 0)
+    goto out_free;
+
+  hdr = buf;
+  snapshot_fill_hdr(hdr, heap, heap_len);
+  hdr->heap_used = heap_used;
+  ret = snapshot_io(bd, 0, buf, PAGE_SIZE, 1);
+
+ out_free:
+  xfree(buf);
+ out_close:
+  close_blkdev(bd);
+  return ret;
+}
+
+#endif // MICROPY_HEAP_SNAPSHOT
@@ -0,0 +1,36 @@
+##################################################################
+#
+# Symbolizes folded stacks written by minipython.alloc_dump():
+# replaces every 0x... frame with the name of the function it
+# belongs to, so the output can be fed to flamegraph.pl.
+#
+#   python foldsym.py build/minipython_x86_64 allocs.txt > allocs.folded
+#   flamegraph.pl allocs.folded > allocs.svg
+#
+##################################################################
+import subprocess
+import sys
+
+def symbolize(image, addrs):
+    if not addrs:
+        return {}
+    out = subprocess.check_output(["addr2line", "-f", "-e", image] + addrs)
+    lines = out.decode().splitlines()
+    # addr2line prints function and file:line for each address
+    return dict(zip(addrs, lines[0::2]))
+
+def main():
+    image, dump = sys.argv[1], sys.argv[2]
+    stacks = []
+    addrs = set()
+    for line in open(dump):
+        frames, count = line.rsplit(" ", 1)
+        frames = frames.split(";")
+        stacks.append((frames, count))
+        addrs.update(f for f in frames if f.startswith("0x"))
+
+    names = symbolize(image, sorted(addrs))
+    for frames, count in stacks:
+        print(";".join(names.get(f, f) for f in frames) + " " + count.strip())
+
+main()
@@ -0,0 +1,191 @@
+/*
+ * Minipython, a Xen-based Unikernel.
+ *
+ * Authors:  Felipe Huici <felipe.huici@neclab.eu>
+ *           Simon Kuenzer <simon.kuenzer@neclab.eu>
+ *
+ *
+ * Copyright (c) 2013-2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "minipython.h"
+
+#if MICROPY_VM_PROFILE || MICROPY_ALLOC_PROFILE
+
+#include "py/bc.h"
+
+/* Returns the source line of the last ip the VM saved in code_state,
+ * looked up in the line-number table of the code info block the same
+ * way tracebacks do. With MICROPY_OPT_COMPUTED_GOTO the VM does not
+ * save the ip of every instruction it dispatches, only at the
+ * instructions that may raise (calls, loads, stores, ...), so the line
+ * is the one of the last such instruction. Before the first one,
+ * code_state->ip may still point into the code info block; that is
+ * reported as the first line of the function. */
+mp_uint_t vm_source_line(const struct _mp_code_state *code_state)
+{
+  const byte *ip = code_state->fun_bc->bytecode;
+  const byte *code_info;
+  mp_uint_t code_info_size, bc, line = 1;
+  mp_uint_t b, l;
+
+  mp_decode_uint(&ip); /* n_state */
+  mp_decode_uint(&ip); /* n_exc_stack */
+  ip += 4;             /* scope flags, n_pos_args, n_kwonly_args, n_def_pos_args */
+  code_info = ip;
+  code_info_size = mp_decode_uint(&ip);
+  if (code_state->ip > code_info + code_info_size)
+    bc = code_state->ip - (code_info + code_info_size);
+  else
+    bc = 0;
+#if MICROPY_PERSISTENT_CODE
+  ip += 4;             /* block name and source file qstrs */
+#else
+  mp_decode_uint(&ip);
+  mp_decode_uint(&ip);
+#endif
+
+  while (*ip) {
+    if ((*ip & 0x80) == 0) {
+      /* 0b0LLBBBBB */
+      b = *ip & 0x1f;
+      l = *ip >> 5;
+      ip += 1;
+    } else {
+      /* 0b1LLLBBBB 0bLLLLLLLL */
+      b = *ip & 0xf;
+      l = ((*ip << 4) & 0x700) | ip[1];
+      ip += 2;
+    }
+    if (bc < b)
+      break;
+    bc -= b;
+    line += l;
+  }
+  return line;
+}
+
+#endif /* MICROPY_VM_PROFILE || MICROPY_ALLOC_PROFILE */
+
+#if MICROPY_VM_PROFILE
+
+#include <mini-os/time.h>
+
+/* Sampling bytecode profiler
+ *
+ * The VM calls vmprof_hook() every MICROPY_VM_HOOK_COUNT jumps and
+ * returns (see MICROPY_VM_HOOK_* in mpconfigport.h). When the sampling
+ * period has elapsed since the last sample, the name and current line
+ * of the running Python function are stored together with the script
+ * being run in a ring buffer. A disabled profiler costs one compare
+ * per hook; a sample costs a read of the system time and a few stores,
+ * so overhead stays well below 1% at the default rate.
+ *
+ * Callers are only known in stackless mode (CONFIG_STACKLESS=y), where
+ * frames are chained through code_state->prev; up to VMPROF_DEPTH of
+ * them are recorded. Otherwise the callers' code states live in the
+ * C frames of mp_execute_bytecode() and every sample has depth 1, so
+ * a flame graph of the dump is flat: one bar per function and line.
+ *
+ * The ring has a single writer (the VM) and is only read from the same
+ * thread, so it needs no locking; when it wraps, the oldest samples are
+ * overwritten. vmprof_dump() writes one collapsed stack per sample
+ * ("script;outer:line;...;inner:line 1"); flamegraph.pl sums equal
+ * lines.
+ */
+
+#define VMPROF_DEPTH    8
+#define VMPROF_RING_LEN 2048
+
+struct vmprof_sample {
+  uint32_t script;
+  uint32_t fun[VMPROF_DEPTH];  /* innermost first */
+  uint32_t line[VMPROF_DEPTH];
+  uint8_t  depth;
+};
+
+STATIC struct vmprof_sample vmprof_ring[VMPROF_RING_LEN];
+STATIC uint32_t vmprof_head;    /* number of samples taken */
+STATIC s_time_t vmprof_period;  /* 0: disabled */
+STATIC s_time_t vmprof_next;
+
+void vmprof_hook(const struct _mp_code_state *code_state)
+{
+  struct vmprof_sample *s;
+  s_time_t now;
+
+  if (!vmprof_period)
+    return;
+  now = NOW();
+  if (now < vmprof_next)
+    return;
+  vmprof_next = now + vmprof_period;
+
+  s = &vmprof_ring[vmprof_head % VMPROF_RING_LEN];
+  s->script = current_script;
+  for (s->depth = 0; code_state && s->depth < VMPROF_DEPTH; ++s->depth) {
+    s->fun[s->depth] = mp_obj_fun_get_name(MP_OBJ_FROM_PTR(code_state->fun_bc));
+    s->line[s->depth] = vm_source_line(code_state);
+#if MICROPY_STACKLESS
+    code_state = code_state->prev;
+#else
+    code_state = NULL; /* callers are on the C stack */
+#endif
+  }
+  ++vmprof_head;
+}
+
+/* Samples hz times per second (0 stops) and clears earlier samples */
+void vmprof_start(unsigned int hz)
+{
+  vmprof_head = 0;
+  vmprof_period = hz ? SECONDS(1) / hz : 0;
+  vmprof_next = NOW() + vmprof_period;
+}
+
+/* Writes the samples in the ring as collapsed stacks through print;
+ * returns the number of samples written */
+unsigned int vmprof_dump(const mp_print_t *print)
+{
+  struct vmprof_sample *s;
+  uint32_t i, n;
+  int d;
+
+  n = vmprof_head < VMPROF_RING_LEN ? vmprof_head : VMPROF_RING_LEN;
+  for (i = vmprof_head - n; i < vmprof_head; ++i) {
+    s = &vmprof_ring[i % VMPROF_RING_LEN];
+    mp_printf(print, "%s", s->script == MP_QSTR_ ? "-" : qstr_str(s->script));
+    for (d = s->depth - 1; d >= 0; --d)
+      mp_printf(print, ";%s:%u", qstr_str(s->fun[d]), (unsigned int) s->line[d]);
+    mp_printf(print, " 1\n");
+  }
+  return n;
+}
+
+#endif /* MICROPY_VM_PROFILE */